@@ -0,0 +1,106 @@
+/*
+ * band_pool.c - Persistent threads splitting a conversion into row bands
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "band_pool.h"
+
+// Take the next band of the running job and convert it; lock held on entry and exit
+static void run_band(band_pool_t *pool) {
+    int band = pool->next_band++;
+    band_fn fn = pool->fn;
+    void *arg = pool->arg;
+    int first = band * pool->band_rows;
+    int count = pool->rows - first < pool->band_rows ? pool->rows - first : pool->band_rows;
+    pthread_mutex_unlock(&pool->lock);
+
+    fn(arg, first, count);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) pthread_cond_signal(&pool->done);
+}
+
+static void *worker_main(void *data) {
+    band_pool_t *pool = data;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (pool->next_band >= pool->bands && !pool->stopping) pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stopping) break;
+        run_band(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+bool band_pool_init(band_pool_t *pool, int threads) {
+    memset(pool, 0, sizeof(*pool));
+    if (threads > BAND_POOL_MAX_THREADS) threads = BAND_POOL_MAX_THREADS;
+
+    pthread_mutex_init(&pool->busy, NULL);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (int i = 0; i < threads - 1; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            fprintf(stderr, "Failed to start conversion thread %d\n", i);
+            break;
+        }
+        pool->thread_count++;
+    }
+
+    if (pool->thread_count == 0) {
+        band_pool_destroy(pool);
+        return false;
+    }
+    return true;
+}
+
+void band_pool_destroy(band_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->thread_count; i++) pthread_join(pool->threads[i], NULL);
+    pool->thread_count = 0;
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->start);
+    pthread_mutex_destroy(&pool->lock);
+    pthread_mutex_destroy(&pool->busy);
+}
+
+void band_pool_run(band_pool_t *pool, band_fn fn, void *arg,
+                   int rows, int row_pixels, int align, int min_pixels) {
+    // Small jobs are not worth waking anyone for
+    long pixels = (long)rows * row_pixels;
+    int bands = pool->thread_count + 1;
+    if (pixels / min_pixels < bands) bands = (int)(pixels / min_pixels);
+    if (bands < 2 || pthread_mutex_trylock(&pool->busy) != 0) {
+        fn(arg, 0, rows);
+        return;
+    }
+
+    int band_rows = (rows + bands - 1) / bands;
+    band_rows = (band_rows + align - 1) / align * align;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->rows = rows;
+    pool->band_rows = band_rows;
+    pool->bands = (rows + band_rows - 1) / band_rows;
+    pool->next_band = 0;
+    pool->pending = pool->bands;
+    pthread_cond_broadcast(&pool->start);
+
+    // Convert bands here too rather than sleep until the workers are done
+    while (pool->next_band < pool->bands) run_band(pool);
+    while (pool->pending > 0) pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_mutex_unlock(&pool->busy);
+}
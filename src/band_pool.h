@@ -0,0 +1,47 @@
+/*
+ * band_pool.h - Persistent threads splitting a conversion into row bands
+ *
+ * A frame conversion is cut into horizontal bands that the workers and the
+ * calling thread convert in parallel; band_pool_run returns once every band
+ * is done, so the output is complete for upload. One job runs at a time: a
+ * second caller (another decode worker, say) converts on its own thread
+ * instead of waiting, the cores being busy already.
+ */
+
+#ifndef BAND_POOL_H
+#define BAND_POOL_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+#define BAND_POOL_MAX_THREADS 16
+
+// Convert rows [first, first + count) of the job
+typedef void (*band_fn)(void *arg, int first, int count);
+
+typedef struct {
+    pthread_t threads[BAND_POOL_MAX_THREADS];
+    int thread_count;        // Workers, the caller converts a band as well
+
+    pthread_mutex_t busy;    // Held by the caller whose job is running
+    pthread_mutex_t lock;
+    pthread_cond_t start;    // Bands to take, or stopping
+    pthread_cond_t done;     // Last band of the job finished
+    band_fn fn;
+    void *arg;
+    int rows, band_rows;
+    int next_band, bands;    // Bands handed out so far, of bands
+    int pending;             // Bands not finished yet
+    bool stopping;
+} band_pool_t;
+
+// Start threads - 1 workers (threads counts the caller); false if none started
+bool band_pool_init(band_pool_t *pool, int threads);
+void band_pool_destroy(band_pool_t *pool);
+
+// Run fn over rows in bands of at least min_pixels (rows * row_pixels) and a
+// multiple of align rows, one band per thread at most. Blocks until all are done.
+void band_pool_run(band_pool_t *pool, band_fn fn, void *arg,
+                   int rows, int row_pixels, int align, int min_pixels);
+
+#endif
@@ -0,0 +1,203 @@
+/*
+ * bench.c - Headless capture + conversion throughput benchmark
+ *
+ * Runs any capture source (V4L2, synth, replay) through the same
+ * conversion path as capturedisp, without SDL, and reports timings.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+#include <linux/videodev2.h>
+
+#include "capture.h"
+#include "telemetry.h"
+#include "yuyv.h"
+
+static double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+int main(int argc, char *argv[]) {
+    const char *device = "synth@0";
+    int frames = 600;
+    int buffers = 2;
+    int latest = 0;
+    int device_crop = 0;
+    int userptr = 0;
+    int read_pass = 0;
+    int tune = 0;
+    int upscale = 1;
+    int planar = 0;
+    int threads = 1;
+    int average = 0;
+    int crop_x = 448, crop_y = 83, crop_w = 1024, crop_h = 912;
+
+    static struct option long_opts[] = {
+        {"device", required_argument, 0, 'd'},
+        {"frames", required_argument, 0, 'n'},
+        {"buffers", required_argument, 0, 'b'},
+        {"crop", required_argument, 0, 'c'},
+        {"latest", no_argument, 0, 'l'},
+        {"device-crop", no_argument, 0, 'D'},
+        {"userptr", no_argument, 0, 'u'},
+        {"read", no_argument, 0, 'r'},
+        {"tune", no_argument, 0, 't'},
+        {"upscale", required_argument, 0, 's'},
+        {"yuv", no_argument, 0, 'y'},
+        {"threads", required_argument, 0, 'p'},
+        {"average", no_argument, 0, 'a'},
+        {"help", no_argument, 0, 'h'},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "d:n:b:c:lDurts:yp:ah", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'd': device = optarg; break;
+            case 'n': frames = atoi(optarg); break;
+            case 'b': buffers = atoi(optarg); break;
+            case 'l': latest = 1; break;
+            case 'D': device_crop = 1; break;
+            case 'u': userptr = 1; break;
+            case 'r': read_pass = 1; break;
+            case 't': tune = 1; break;
+            case 's': upscale = atoi(optarg); break;
+            case 'y': planar = 1; break;
+            case 'p': threads = atoi(optarg); break;
+            case 'a': average = 1; break;
+            case 'c':
+                if (sscanf(optarg, "%d,%d,%d,%d", &crop_x, &crop_y, &crop_w, &crop_h) != 4) {
+                    fprintf(stderr, "Crop must be X,Y,W,H\n");
+                    return 1;
+                }
+                break;
+            case 'h':
+            default:
+                printf("Usage: %s [options]\n", argv[0]);
+                printf("  -d, --device DEV    Capture source (default synth@0)\n");
+                printf("  -n, --frames N      Frames to process (default 600)\n");
+                printf("  -b, --buffers N     Capture buffers (default 2)\n");
+                printf("  -c, --crop X,Y,W,H  Crop to convert (default NES preset)\n");
+                printf("  -l, --latest        Drain the queue, convert only the newest frame\n");
+                printf("  -D, --device-crop   Have the device crop (VIDIOC_S_SELECTION) if it can\n");
+                printf("  -u, --userptr       Capture into a huge-page pool (V4L2_MEMORY_USERPTR)\n");
+                printf("  -r, --read          Time a plain read of every frame (cost of the buffer memory)\n");
+                printf("  -s, --upscale N     Content is an N x upscale, decode MJPEG at native size when aligned\n");
+                printf("  -y, --yuv           Convert to I420 planes for a YUV texture instead of RGBA\n");
+                printf("  -p, --threads N     Split YUYV conversion into row bands on N threads (0 = one per core)\n");
+                printf("  -a, --average       With -s, average each YUYV cell instead of sampling its middle\n");
+                printf("  -t, --tune          Auto-tune the buffer count (from -b, up to %d) on drops\n", CAPTURE_MAX_BUFFERS);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    capture_request_t request = {
+        .width = 1920, .height = 1080,
+        .crop_w = 1920, .crop_h = 1080,
+        .min_crop_w = 1920, .min_crop_h = 1080,
+        .fps = 60,
+        .userptr = userptr,
+    };
+    capture_ctx_t *capture = capture_open_request(device, &request, buffers);
+    if (!capture) return 1;
+    printf("Memory:   %s\n", capture->memory == V4L2_MEMORY_USERPTR ? "USERPTR pool" : "MMAP");
+    if (capture->format == V4L2_PIX_FMT_YUYV) printf("Kernel:   %s (YUYV to RGBA)\n", yuyv_kernel_name());
+    if (threads != 1 && !capture_set_convert_threads(threads)) threads = 1;
+    capture_set_native_average(average);
+
+    if (crop_x + crop_w > capture->width || crop_y + crop_h > capture->height) {
+        crop_x = 0; crop_y = 0;
+        crop_w = capture->width; crop_h = capture->height;
+    }
+    crop_x &= ~1;
+    crop_w &= ~1;
+    uint8_t *crop_buffer = malloc(crop_w * crop_h * 4);
+    
+    if (device_crop && capture_set_crop(capture, crop_x, crop_y, crop_w, crop_h)) {
+        crop_x -= capture->crop_left;
+        crop_y -= capture->crop_top;
+    }
+
+    printf("Converting %d frames, crop %dx%d at (%d,%d)\n", frames, crop_w, crop_h, crop_x, crop_y);
+
+    double wait_ms = 0, convert_ms = 0, worst_ms = 0, read_ms = 0;
+    int scale = 1;
+    uint64_t read_bytes = 0, checksum = 0;
+    latency_stats_t latency;
+    latency_init(&latency);
+    double start = now_ms();
+    for (int n = 0; n < frames; n++) {
+        capture_frame_t *frame;
+        double t0 = now_ms();
+        while (!(frame = latest ? capture_acquire_latest(capture, NULL) : capture_acquire(capture))) {
+            capture_wait_t waited = capture_wait_frame(capture, 1000);
+            if (waited == CAPTURE_WAIT_SOURCE_CHANGE) capture_renegotiate(capture);
+            if (waited == CAPTURE_WAIT_ERROR) {
+                fprintf(stderr, "Capture failed\n");
+                return 1;
+            }
+        }
+        double t1 = now_ms();
+
+        // Memory cost alone: uncached driver buffers show up here, not in the conversion maths
+        if (read_pass) {
+            for (size_t i = 0; i + 8 <= frame->size; i += 8) {
+                uint64_t word;
+                memcpy(&word, frame->data + i, 8);
+                checksum += word;
+            }
+            read_bytes += frame->size;
+            double tr = now_ms();
+            read_ms += tr - t1;
+            t1 = tr;
+        }
+
+        scale = 0;
+        if (planar) {
+            scale = capture_convert_crop_iyuv(capture, frame->data, frame->size, crop_buffer,
+                                              crop_x, crop_y, crop_w, crop_h, upscale);
+        }
+        if (!scale) {
+            scale = capture_convert_crop_native(capture, frame->data, frame->size, crop_buffer,
+                                                crop_x, crop_y, crop_w, crop_h, upscale);
+        }
+        uint64_t captured_ns = frame->timestamp_ns;
+        capture_frame_release(frame);
+        double t2 = now_ms();
+        latency_add(&latency, capture_now_ns() - captured_ns);
+        if (tune) capture_tune_buffers(capture, buffers, CAPTURE_MAX_BUFFERS);
+
+        wait_ms += t1 - t0;
+        convert_ms += t2 - t1;
+        if (t2 - t1 > worst_ms) worst_ms = t2 - t1;
+    }
+    double total = now_ms() - start;
+
+    printf("Frames:   %d in %.1f ms (%.1f fps)\n", frames, total, frames * 1000.0 / total);
+    printf("Capture:  %.3f ms/frame\n", wait_ms / frames);
+    printf("Convert:  %.3f ms/frame (worst %.3f ms)%s\n", convert_ms / frames, worst_ms,
+           scale > 1 ? (scale == 2 ? " at 1/2 size" : scale == 4 ? " at 1/4 size" : " at 1/8 size") : "");
+    if (read_pass) {
+        printf("Read:     %.3f ms/frame (%.0f MB/s, checksum %llx)\n", read_ms / frames,
+               read_ms > 0 ? read_bytes / read_ms / 1000.0 : 0, (unsigned long long)checksum);
+    }
+    latency_summary_t lat;
+    latency_summarize(&latency, &lat);
+    printf("Latency:  capture to converted %.3f/%.3f/%.3f ms min/avg/p99 (last %d frames)\n",
+           lat.min_ms, lat.avg_ms, lat.p99_ms, lat.count);
+    printf("Frames:   %llu dequeued, %llu dropped, %llu repeated, %llu errors\n",
+           (unsigned long long)capture->stats.dequeued, (unsigned long long)capture->stats.dropped,
+           (unsigned long long)capture->stats.repeated, (unsigned long long)capture->stats.errors);
+    if (latest) printf("Skipped:  %llu stale frames\n", (unsigned long long)capture->stats.skipped);
+    if (tune) printf("Buffers:  %d after tuning\n", capture->buffer_count);
+
+    free(crop_buffer);
+    capture_set_convert_threads(1);
+    capture_close(capture);
+    return 0;
+}
@@ -1,5 +1,5 @@
 /*
- * capture.h - V4L2 video capture
+ * capture.h - Video capture (V4L2, synthetic and replay sources)
  */
 
 #ifndef CAPTURE_H
@@ -8,27 +8,241 @@
 #include <stdint.h>
 #include <stddef.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 
+struct capture_source;
+struct capture_ctx;
+struct capture_jpeg;
+
+#define CAPTURE_MAX_BUFFERS 32
+
+#define CAPTURE_TS_DRIVER (1u << 0)  // Driver CLOCK_MONOTONIC timestamp, otherwise dequeue time
+#define CAPTURE_TS_SOE    (1u << 1)  // Taken at start of exposure rather than end of frame
+
+// Per-frame metadata carried from DQBUF through the pipeline
 typedef struct {
-    int fd;
-    int width;
+    size_t bytesused;
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC
+    uint32_t ts_flags;      // CAPTURE_TS_*
+    uint32_t sequence;      // Frame counter of the source, gaps mean lost frames
+    bool error;             // Driver flagged the data as possibly corrupt
+} capture_frame_info_t;
+
+// Frame accounting, cumulative since open (copy it across a reopen to keep totals)
+typedef struct {
+    uint64_t dequeued;  // Buffers taken from the source, including drained ones
+    uint64_t dropped;   // Sequence gaps: frames the card or driver never delivered
+    uint64_t repeated;  // Sequence did not advance: same frame delivered twice
+    uint64_t errors;    // Buffers flagged with V4L2_BUF_FLAG_ERROR
+    uint64_t skipped;   // Stale frames dropped by capture_acquire_latest
+} capture_stats_t;
+
+// A dequeued buffer. It stays out of the driver's queue, and data stays valid,
+// until the last reference is released, so several consumers (conversion,
+// analysis, recording) can hold frames at once without copying them.
+// Handles are owned by the context and reused, never freed by the caller.
+typedef struct capture_frame {
+    struct capture_ctx *ctx;
+    int index;              // Buffer index
+    const uint8_t *data;
+    int dmabuf_fd;          // Same buffer as a dmabuf for zero-copy import, -1 = mmap only.
+                            // Owned by the context and closed when streaming restarts, dup() to keep it.
+    size_t size;            // Bytes used
+    uint64_t timestamp_ns;  // CLOCK_MONOTONIC
+    uint32_t ts_flags;      // CAPTURE_TS_*
+    uint32_t sequence;
+    bool error;             // Driver flagged the data as possibly corrupt
+    int width;              // Geometry of data, fixed while the frame is held
     int height;
     uint32_t format;
-    
+    atomic_int refs;
+} capture_frame_t;
+
+// Queue depth auto-tuning state, see capture_tune_buffers
+typedef struct {
+    uint64_t window_ns;       // Start of the current drop-counting window, 0 = not started
+    uint64_t window_dropped;  // stats.dropped at window start
+    uint64_t quiet_ns;        // Drop-free time at the current depth
+    uint64_t patience_ns;     // Drop-free time needed before trying one buffer fewer
+    bool stepped_down;        // Last change removed a buffer
+} capture_tune_t;
+
+// What the caller needs from the device, used to pick among the modes it offers
+typedef struct {
+    int width;       // Reference frame size the crop is expressed in, also the preferred mode
+    int height;
+    int crop_w;      // Active crop in reference pixels
+    int crop_h;
+    int min_crop_w;  // The crop has to keep at least this many pixels in the chosen mode
+    int min_crop_h;
+    int fps;         // Frame rate to sustain
+    bool userptr;    // Capture into our own cacheable pool (V4L2_MEMORY_USERPTR), MMAP if refused
+} capture_request_t;
+
+typedef struct capture_ctx {
+    const struct capture_source *source;  // Backend vtable (V4L2, synth, replay)
+    void *source_data;                    // Backend private state
+
+    int fd;             // V4L2 fd, -1 for non-V4L2 sources
+    int wait_fd;        // Readable when a frame is ready (V4L2 fd or source timerfd), -1 = always ready
+    int wake_fd;        // Optional caller-owned eventfd that interrupts capture_wait_frame, -1 = none
+    uint64_t ready_ns;  // CLOCK_MONOTONIC time capture_wait_frame saw the last frame become ready
+    int release_fd;     // eventfd the last release of a frame signals while capture_wait_frame sleeps
+    atomic_bool waiting;  // capture_wait_frame is (about to be) asleep
+
+    int width;          // Size of the delivered frames
+    int height;
+    uint32_t format;
+    int source_width;   // Negotiated mode size, width/height shrink to it when the device crops
+    int source_height;
+    int crop_left;      // Where delivered frames sit in the source_width x source_height frame
+    int crop_top;
+    bool can_crop;      // Device crops via VIDIOC_S_SELECTION or VIDIOC_S_CROP
+    double fps;                 // Negotiated frame rate, 0 = unknown
+    capture_request_t request;  // What the mode was chosen for
+
     void *buffers;
     int buffer_count;
-    int current_index;
-    
+    uint32_t memory;             // V4L2 buffers: V4L2_MEMORY_MMAP or V4L2_MEMORY_USERPTR
+    uint8_t *pool;               // USERPTR buffers, pool_stride bytes apart
+    size_t pool_size;
+    size_t pool_stride;
+    capture_frame_t frames[CAPTURE_MAX_BUFFERS];  // Handle per buffer index
+    atomic_uint released;        // Bit per buffer index: released, not yet requeued
+    int frames_held;             // Handed out and not requeued, capture thread only
+    capture_stats_t stats;
+    capture_tune_t tune;
+    uint32_t last_sequence;      // Sequence of the previous dequeued buffer
+    bool sequence_valid;         // last_sequence is set (cleared when streaming restarts)
+    bool failed;                 // Source failed to dequeue (e.g. unplugged), waits return CAPTURE_WAIT_ERROR
+
     uint8_t *rgb_buffer;
-    
+    struct capture_jpeg *jpeg;   // MJPEG decoder reused across frames, created on first use
+
     char device[256];  // Store device path for reinit
 } capture_ctx_t;
 
+typedef enum {
+    CAPTURE_WAIT_FRAME,     // A frame can be dequeued now
+    CAPTURE_WAIT_TIMEOUT,
+    CAPTURE_WAIT_WAKE,      // wake_fd was signalled
+    CAPTURE_WAIT_SOURCE_CHANGE,  // Input resolution changed, call capture_renegotiate
+    CAPTURE_WAIT_ERROR      // Device failed or gone, reopen it
+} capture_wait_t;
+
+/*
+ * Device strings:
+ *   /dev/videoX              V4L2 capture device
+ *   synth[:yuyv|mjpeg][@FPS] Synthetic moving test pattern (FPS 0 = unthrottled)
+ *   replay:PATH[@FPS]        Replay a raw YUYV or MJPEG stream recorded with
+ *                            e.g. v4l2-ctl --stream-mmap --stream-to=PATH
+ */
 capture_ctx_t *capture_open(const char *device, int width, int height);
 capture_ctx_t *capture_open_buffers(const char *device, int width, int height, int num_buffers);
+capture_ctx_t *capture_open_request(const char *device, const capture_request_t *request, int num_buffers);
 void capture_close(capture_ctx_t *ctx);
 uint8_t *capture_get_frame(capture_ctx_t *ctx);
-uint8_t *capture_get_frame_raw(capture_ctx_t *ctx, size_t *out_size);
-void capture_return_buffer(capture_ctx_t *ctx);
+
+// Next frame from the queue with one reference, NULL if none is ready.
+// Acquire from one thread; references can be taken and released from any thread.
+capture_frame_t *capture_acquire(capture_ctx_t *ctx);
+
+// Dequeue every ready buffer and requeue all but the newest, so extra buffers
+// add drop resilience without adding queueing latency. *out_skipped = stale frames dropped.
+capture_frame_t *capture_acquire_latest(capture_ctx_t *ctx, int *out_skipped);
+
+capture_frame_t *capture_frame_ref(capture_frame_t *frame);
+
+// Drop a reference. The buffer goes back to the driver on the acquiring
+// thread's next acquire or wait once the last reference is gone; a release from
+// another thread wakes capture_wait_frame to requeue it straight away.
+void capture_frame_release(capture_frame_t *frame);
+
+// Content fingerprint of a compressed frame (payload size and a hash of every
+// byte), equal for byte-identical frames; 0 for uncompressed formats, where
+// capture noise keeps identical pictures apart. Costs one read of the payload.
+uint64_t capture_frame_fingerprint(const capture_frame_t *frame);
+
+// Have the device deliver only this rectangle of the source frame (0 width = full
+// frame). Restarts streaming, so call it with no frame held. Returns true when
+// the device crops; otherwise frames stay full size and the caller crops in software.
+// Frames may be larger than asked for when the driver rounds, see crop_left/crop_top.
+bool capture_set_crop(capture_ctx_t *ctx, int x, int y, int w, int h);
+
+// Re-pick the mode after CAPTURE_WAIT_SOURCE_CHANGE: stops streaming, renegotiates
+// format and frame rate for the new input and restarts with the same buffer count.
+// Call it with no frame held. False when there is no signal (nothing changed) or it failed.
+bool capture_renegotiate(capture_ctx_t *ctx);
+
+// New crop or content scale to pick the mode for: when another mode now wins,
+// renegotiates as capture_renegotiate does (call it with no frame held then).
+// True when the device switched modes.
+bool capture_set_request(capture_ctx_t *ctx, const capture_request_t *request);
+
+// Change the queue depth in place: stops streaming, requests num_buffers buffers and
+// restarts on the open device, keeping format, frame rate and device crop.
+// Call it with no frame held. False if the source cannot, the old queue may be gone then.
+bool capture_set_buffer_count(capture_ctx_t *ctx, int num_buffers);
+
+// Queue depth auto-tuning between min_buffers and max_buffers: one buffer more
+// after dropped frames, one fewer after a drop-free period that grows each time
+// a step down had to be undone. Call it regularly from the acquiring thread, e.g.
+// once per loop; changes wait for a call with no frame held. True when the count changed.
+bool capture_tune_buffers(capture_ctx_t *ctx, int min_buffers, int max_buffers);
+
+// CLOCK_MONOTONIC in nanoseconds, the clock frame timestamps use
+uint64_t capture_now_ns(void);
+
+// Sleep until a frame is ready, wake_fd is signalled or timeout_ms passes (-1 = forever)
+capture_wait_t capture_wait_frame(capture_ctx_t *ctx, int timeout_ms);
+
+// Decode a raw frame to full-size RGBA in ctx->rgb_buffer (MJPEG or YUYV)
+uint8_t *capture_decode_frame(capture_ctx_t *ctx, const uint8_t *raw, size_t size);
+
+// Convert the crop rectangle of a raw frame to RGBA (crop_w * 4 stride)
+void capture_convert_crop(capture_ctx_t *ctx, const uint8_t *raw, size_t size,
+                          uint8_t *dst, int crop_x, int crop_y, int crop_w, int crop_h);
+
+// Same, for content that is an integer upscale (by `upscale`, native pixels starting
+// at the crop origin): YUYV is sampled in the middle of each cell and converted at
+// native size; MJPEG is decoded at 1/2, 1/4 or 1/8 size in the DCT domain when that
+// keeps one output pixel per native pixel at most, chroma included.
+// Returns the scale used, dst gets crop_w/scale x crop_h/scale pixels (1 = full size,
+// e.g. an unaligned MJPEG crop, 4:2:2 chroma at upscale 2 or no libjpeg-turbo).
+int capture_convert_crop_native(capture_ctx_t *ctx, const uint8_t *raw, size_t size, uint8_t *dst,
+                                int crop_x, int crop_y, int crop_w, int crop_h, int upscale);
+
+// Same crop as I420 planes for a YUV texture, so colour conversion runs on the GPU:
+// Y at (crop_w/scale) x (crop_h/scale) rounded down to even sizes, then U and V at
+// half that each way; scale as for capture_convert_crop_native. MJPEG is decoded to
+// YCbCr without colour conversion, which saves little: decoding dominates.
+// Returns 0 when the frame cannot be delivered as planes (not YCbCr, unusual
+// subsampling): convert it to RGBA instead.
+int capture_convert_crop_iyuv(capture_ctx_t *ctx, const uint8_t *raw, size_t size, uint8_t *dst,
+                              int crop_x, int crop_y, int crop_w, int crop_h, int upscale);
+
+// Split YUYV conversions (crop, full frame and I420) into row bands converted on
+// `threads` threads at once, the calling one included; 0 = one per online core,
+// 1 = convert on the calling thread only (the default). Small crops get fewer
+// bands. Process-wide: call it while nothing is converting. False if no thread started.
+bool capture_set_convert_threads(int threads);
+
+// Native-size YUYV conversion (upscale > 1): average each cell, luma over its
+// pixels and chroma over its chroma samples, instead of taking the pixel in its
+// middle. Costs a little more, but evens out capture noise and chroma bleed.
+// Process-wide, may change while converting. MJPEG's DCT scaling averages already.
+void capture_set_native_average(bool average);
+
+// A private MJPEG decoder, so frames can be converted on other threads than the
+// acquiring one (capture_decode_frame and capture_convert_* share the context's).
+// One thread per decoder; the frame must stay referenced until the call returns.
+typedef struct capture_jpeg capture_decoder_t;
+capture_decoder_t *capture_decoder_create(void);
+void capture_decoder_destroy(capture_decoder_t *decoder);
+// capture_convert_crop_native on a held frame, returns the scale used
+int capture_decoder_convert(capture_decoder_t *decoder, const capture_frame_t *frame, uint8_t *dst,
+                            int crop_x, int crop_y, int crop_w, int crop_h, int upscale);
+int capture_decoder_convert_iyuv(capture_decoder_t *decoder, const capture_frame_t *frame, uint8_t *dst,
+                                 int crop_x, int crop_y, int crop_w, int crop_h, int upscale);
 
 #endif
@@ -0,0 +1,217 @@
+/*
+ * capture_modes.c - V4L2 mode enumeration and selection
+ *
+ * Lists every format/size/interval the device offers that we can convert,
+ * and picks the cheapest one that fits the USB bus, runs at the requested
+ * frame rate and still resolves the active crop.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
+#include "capture.h"
+#include "capture_source.h"
+
+// Capture-card MJPEG at 1080p is typically 200-300 KB per frame
+#define MJPEG_BYTES_PER_PIXEL 0.15
+
+// Relative conversion cost per pixel, rough estimates rather than measurements:
+// YUYV converts only the crop; MJPEG entropy-decodes the whole frame but only
+// runs IDCT and colour conversion on the crop (4.0 per pixel for a full frame)
+#define YUYV_COST_PER_CROP_PIXEL 3.0
+#define MJPEG_COST_PER_FRAME_PIXEL 1.5
+#define MJPEG_COST_PER_CROP_PIXEL 2.5
+
+// Isochronous share of the raw USB signalling rate (USB2: 3 x 1024 bytes per microframe)
+#define USB_ISO_EFFICIENCY 0.4
+
+static int xioctl(int fd, unsigned long request, void *arg) {
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+static bool add_mode(capture_mode_t **modes, int *count, int *cap, const capture_mode_t *mode) {
+    if (*count == *cap) {
+        int grown_cap = *cap ? *cap * 2 : 32;
+        capture_mode_t *grown = realloc(*modes, grown_cap * sizeof(capture_mode_t));
+        if (!grown) return false;
+        *modes = grown;
+        *cap = grown_cap;
+    }
+    (*modes)[(*count)++] = *mode;
+    return true;
+}
+
+// Add one mode per frame interval of format/size
+static void enum_intervals(int fd, capture_mode_t mode, capture_mode_t **modes, int *count, int *cap) {
+    struct v4l2_frmivalenum ival = {0};
+    ival.pixel_format = mode.format;
+    ival.width = mode.width;
+    ival.height = mode.height;
+
+    for (ival.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMEINTERVALS, &ival) == 0; ival.index++) {
+        if (ival.type == V4L2_FRMIVAL_TYPE_DISCRETE) {
+            mode.interval_num = ival.discrete.numerator;
+            mode.interval_den = ival.discrete.denominator;
+            add_mode(modes, count, cap, &mode);
+            continue;
+        }
+        // Stepwise or continuous: only the fastest end matters
+        mode.interval_num = ival.stepwise.min.numerator;
+        mode.interval_den = ival.stepwise.min.denominator;
+        add_mode(modes, count, cap, &mode);
+        break;
+    }
+
+    // Driver does not list intervals, rate unknown
+    if (ival.index == 0) {
+        mode.interval_num = 0;
+        mode.interval_den = 0;
+        add_mode(modes, count, cap, &mode);
+    }
+}
+
+int v4l2_enum_modes(int fd, int pref_width, int pref_height, capture_mode_t **out) {
+    capture_mode_t *modes = NULL;
+    int count = 0, cap = 0;
+
+    struct v4l2_fmtdesc desc = {0};
+    desc.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    for (desc.index = 0; xioctl(fd, VIDIOC_ENUM_FMT, &desc) == 0; desc.index++) {
+        if (desc.pixelformat != V4L2_PIX_FMT_MJPEG && desc.pixelformat != V4L2_PIX_FMT_YUYV) continue;
+
+        struct v4l2_frmsizeenum size = {0};
+        size.pixel_format = desc.pixelformat;
+        for (size.index = 0; xioctl(fd, VIDIOC_ENUM_FRAMESIZES, &size) == 0; size.index++) {
+            capture_mode_t mode = { .format = desc.pixelformat };
+            if (size.type == V4L2_FRMSIZE_TYPE_DISCRETE) {
+                mode.width = size.discrete.width;
+                mode.height = size.discrete.height;
+                enum_intervals(fd, mode, &modes, &count, &cap);
+                continue;
+            }
+
+            // Stepwise or continuous: the largest size, plus the preferred one if it is in range
+            const struct v4l2_frmsize_stepwise *sw = &size.stepwise;
+            mode.width = sw->max_width;
+            mode.height = sw->max_height;
+            enum_intervals(fd, mode, &modes, &count, &cap);
+            if ((uint32_t)pref_width >= sw->min_width && (uint32_t)pref_width < sw->max_width &&
+                (uint32_t)pref_height >= sw->min_height && (uint32_t)pref_height < sw->max_height) {
+                mode.width = pref_width;
+                mode.height = pref_height;
+                enum_intervals(fd, mode, &modes, &count, &cap);
+            }
+            break;
+        }
+    }
+
+    *out = modes;
+    return count;
+}
+
+double capture_mode_fps(const capture_mode_t *mode) {
+    if (mode->interval_num == 0) return 0;
+    return (double)mode->interval_den / mode->interval_num;
+}
+
+double capture_mode_bandwidth(const capture_mode_t *mode, double fps) {
+    double pixels = (double)mode->width * mode->height;
+    double bytes = mode->format == V4L2_PIX_FMT_YUYV ? pixels * 2 : pixels * MJPEG_BYTES_PER_PIXEL;
+    return bytes * fps;
+}
+
+// Conversion cost of one frame, arbitrary units
+static double mode_cost(const capture_mode_t *mode, const capture_request_t *req) {
+    double crop_pixels = (double)req->crop_w * mode->width / req->width *
+                         req->crop_h * mode->height / req->height;
+    if (mode->format == V4L2_PIX_FMT_YUYV) return crop_pixels * YUYV_COST_PER_CROP_PIXEL;
+    return (double)mode->width * mode->height * MJPEG_COST_PER_FRAME_PIXEL +
+           crop_pixels * MJPEG_COST_PER_CROP_PIXEL;
+}
+
+// Lower is better: requirements broken, most important first, then cost
+typedef struct {
+    int tier;
+    double fps_short;  // How far below the requested rate
+    double cost;       // Conversion work per second
+    int area;          // Tie-break: prefer more pixels
+} mode_score_t;
+
+static mode_score_t score_mode(const capture_mode_t *mode, const capture_request_t *req, double usb_budget) {
+    double fps = capture_mode_fps(mode);
+    double used_fps = fps > 0 && fps < req->fps ? fps : req->fps;
+
+    // Crop coordinates scale with the frame, so the aspect ratio has to match the reference
+    long long aspect_diff = llabs((long long)mode->width * req->height - (long long)mode->height * req->width);
+    bool same_aspect = aspect_diff * 100 <= (long long)mode->height * req->width;
+    bool covers = same_aspect &&
+                  (long long)req->crop_w * mode->width / req->width >= req->min_crop_w &&
+                  (long long)req->crop_h * mode->height / req->height >= req->min_crop_h;
+    bool fits_bus = usb_budget <= 0 || capture_mode_bandwidth(mode, used_fps) <= usb_budget;
+    bool meets_rate = fps >= req->fps - 0.5;
+
+    mode_score_t score;
+    score.tier = (!same_aspect ? 8 : 0) + (!fits_bus ? 4 : 0) + (!meets_rate ? 2 : 0) + (!covers ? 1 : 0);
+    score.fps_short = meets_rate ? 0 : req->fps - fps;
+    score.cost = mode_cost(mode, req) * used_fps;
+    score.area = mode->width * mode->height;
+    return score;
+}
+
+static bool score_better(const mode_score_t *a, const mode_score_t *b) {
+    if (a->tier != b->tier) return a->tier < b->tier;
+    if (a->fps_short != b->fps_short) return a->fps_short < b->fps_short;
+    if (a->cost != b->cost) return a->cost < b->cost;
+    return a->area > b->area;
+}
+
+const capture_mode_t *capture_pick_mode(const capture_mode_t *modes, int count,
+                                        const capture_request_t *req, double usb_budget) {
+    const capture_mode_t *best = NULL;
+    mode_score_t best_score = {0};
+
+    for (int i = 0; i < count; i++) {
+        mode_score_t score = score_mode(&modes[i], req, usb_budget);
+        if (!best || score_better(&score, &best_score)) {
+            best = &modes[i];
+            best_score = score;
+        }
+    }
+
+    if (best && best_score.tier != 0) {
+        fprintf(stderr, "No mode meets every requirement:%s%s%s%s\n",
+                best_score.tier & 8 ? " aspect" : "",
+                best_score.tier & 4 ? " bandwidth" : "",
+                best_score.tier & 2 ? " frame-rate" : "",
+                best_score.tier & 1 ? " crop-detail" : "");
+    }
+    return best;
+}
+
+double v4l2_usb_budget(const char *device) {
+    char real[PATH_MAX];
+    if (!realpath(device, real)) return 0;
+
+    // /dev/videoN -> /sys/class/video4linux/videoN/device is the USB interface,
+    // its parent the USB device with the negotiated speed in Mbit/s
+    const char *name = strrchr(real, '/');
+    char path[PATH_MAX + 64];
+    snprintf(path, sizeof(path), "/sys/class/video4linux/%s/device/../speed", name ? name + 1 : real);
+
+    FILE *f = fopen(path, "r");
+    if (!f) return 0;
+    double mbps = 0;
+    if (fscanf(f, "%lf", &mbps) != 1) mbps = 0;
+    fclose(f);
+
+    return mbps * 1e6 / 8 * USB_ISO_EFFICIENCY;
+}
@@ -0,0 +1,275 @@
+/*
+ * capture_replay.c - Replay a recorded raw capture stream
+ *
+ * The file is mmapped and frames are handed out straight from the mapping,
+ * so replay costs nothing but page faults. Two layouts are understood:
+ *   - MJPEG: concatenated JPEG frames (starts with FF D8 FF)
+ *   - YUYV:  concatenated width*height*2 frames at the requested size
+ * which is what v4l2-ctl --stream-mmap --stream-to=FILE writes.
+ *
+ *   replay:PATH[@FPS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <setjmp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <linux/videodev2.h>
+#include <jpeglib.h>
+
+#include "capture.h"
+#include "capture_source.h"
+
+#define REPLAY_DEFAULT_FPS 60
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} replay_frame_t;
+
+typedef struct {
+    uint8_t *map;
+    size_t map_size;
+
+    replay_frame_t *frames;
+    int frame_count;
+    int next_frame;
+
+    source_clock_t clock;
+    bool *queued;
+    int next_buffer;
+} replay_t;
+
+static bool is_jpeg_start(const uint8_t *p, size_t avail) {
+    return avail >= 3 && p[0] == 0xFF && p[1] == 0xD8 && p[2] == 0xFF;
+}
+
+// Split a concatenated MJPEG stream at each start-of-image marker
+static int index_mjpeg(replay_t *r) {
+    int cap = 256;
+    r->frames = malloc(cap * sizeof(replay_frame_t));
+    if (!r->frames) return 0;
+
+    size_t start = 0;
+    for (size_t i = 1; i + 3 <= r->map_size; i++) {
+        if (r->map[i] != 0xFF || !is_jpeg_start(r->map + i, r->map_size - i)) continue;
+        if (r->frame_count == cap) {
+            cap *= 2;
+            replay_frame_t *grown = realloc(r->frames, cap * sizeof(replay_frame_t));
+            if (!grown) return r->frame_count;
+            r->frames = grown;
+        }
+        r->frames[r->frame_count++] = (replay_frame_t){ start, i - start };
+        start = i;
+    }
+    if (r->frame_count == cap) {
+        replay_frame_t *grown = realloc(r->frames, (cap + 1) * sizeof(replay_frame_t));
+        if (!grown) return r->frame_count;
+        r->frames = grown;
+    }
+    r->frames[r->frame_count++] = (replay_frame_t){ start, r->map_size - start };
+    return r->frame_count;
+}
+
+struct replay_jpeg_err {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+};
+
+static void replay_jpeg_error_exit(j_common_ptr cinfo) {
+    longjmp(((struct replay_jpeg_err*)cinfo->err)->jmp, 1);
+}
+
+// Frame size comes from the first JPEG header
+static bool mjpeg_dimensions(const uint8_t *data, size_t size, int *width, int *height) {
+    struct jpeg_decompress_struct cinfo;
+    struct replay_jpeg_err jerr;
+
+    cinfo.err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = replay_jpeg_error_exit;
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, data, size);
+    jpeg_read_header(&cinfo, TRUE);
+    *width = cinfo.image_width;
+    *height = cinfo.image_height;
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+static void replay_close(capture_ctx_t *ctx) {
+    replay_t *r = ctx->source_data;
+    free(ctx->buffers);
+    if (r) {
+        if (r->map && r->map != MAP_FAILED) munmap(r->map, r->map_size);
+        free(r->frames);
+        free(r->queued);
+        source_clock_close(&r->clock);
+        free(r);
+    }
+}
+
+static bool replay_open(capture_ctx_t *ctx, const char *arg, int width, int height, int num_buffers) {
+    char path[256];
+    strncpy(path, arg, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    int fps = source_parse_fps(path, REPLAY_DEFAULT_FPS);
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Cannot open replay file %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "Replay file %s is empty\n", path);
+        close(fd);
+        return false;
+    }
+
+    replay_t *r = calloc(1, sizeof(replay_t));
+    if (!r) {
+        close(fd);
+        return false;
+    }
+    r->clock.fd = -1;
+    ctx->source_data = r;
+
+    r->map_size = st.st_size;
+    r->map = mmap(NULL, r->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (r->map == MAP_FAILED) {
+        fprintf(stderr, "mmap of %s failed: %s\n", path, strerror(errno));
+        goto error;
+    }
+    madvise(r->map, r->map_size, MADV_SEQUENTIAL);
+
+    if (is_jpeg_start(r->map, r->map_size)) {
+        ctx->format = V4L2_PIX_FMT_MJPEG;
+        if (index_mjpeg(r) == 0 ||
+            !mjpeg_dimensions(r->map + r->frames[0].offset, r->frames[0].size, &width, &height)) {
+            fprintf(stderr, "Replay file %s: cannot parse MJPEG stream\n", path);
+            goto error;
+        }
+    } else {
+        ctx->format = V4L2_PIX_FMT_YUYV;
+        size_t frame_size = (size_t)width * height * 2;
+        r->frame_count = r->map_size / frame_size;
+        if (r->frame_count == 0) {
+            fprintf(stderr, "Replay file %s is smaller than one %dx%d YUYV frame\n", path, width, height);
+            goto error;
+        }
+        r->frames = malloc(r->frame_count * sizeof(replay_frame_t));
+        if (!r->frames) goto error;
+        for (int i = 0; i < r->frame_count; i++) {
+            r->frames[i] = (replay_frame_t){ i * frame_size, frame_size };
+        }
+    }
+
+    ctx->width = width;
+    ctx->height = height;
+    ctx->fps = fps;
+
+    // Buffers only model queue depth - their start pointers are aimed into the mapping on dequeue
+    if (num_buffers < 1) num_buffers = 1;
+    ctx->buffers = calloc(num_buffers, sizeof(buffer_t));
+    r->queued = calloc(num_buffers, sizeof(bool));
+    if (!ctx->buffers || !r->queued) goto error;
+    ctx->buffer_count = num_buffers;
+    for (int i = 0; i < num_buffers; i++) {
+        ((buffer_t*)ctx->buffers)[i].dmabuf_fd = -1;
+        r->queued[i] = true;
+    }
+
+    if (!source_clock_init(&r->clock, fps)) goto error;
+    ctx->wait_fd = r->clock.fd;
+
+    printf("Capture: replay %s %dx%d %.4s, %d frames @ %d fps (%d buffers)\n",
+           path, ctx->width, ctx->height, (char*)&ctx->format, r->frame_count, fps, num_buffers);
+    return true;
+
+error:
+    replay_close(ctx);
+    ctx->buffers = NULL;
+    ctx->source_data = NULL;
+    return false;
+}
+
+// Buffers only model queue depth, so a new depth is just new bookkeeping
+static bool replay_set_buffer_count(capture_ctx_t *ctx, int num_buffers) {
+    replay_t *r = ctx->source_data;
+    buffer_t *buffers = calloc(num_buffers, sizeof(buffer_t));
+    bool *queued = calloc(num_buffers, sizeof(bool));
+    if (!buffers || !queued) {
+        free(buffers);
+        free(queued);
+        return false;
+    }
+    for (int i = 0; i < num_buffers; i++) {
+        buffers[i].dmabuf_fd = -1;
+        queued[i] = true;
+    }
+    
+    free(ctx->buffers);
+    free(r->queued);
+    ctx->buffers = buffers;
+    ctx->buffer_count = num_buffers;
+    r->queued = queued;
+    r->next_buffer = 0;
+    r->clock.pending = 0;
+    return true;
+}
+
+static int replay_dequeue(capture_ctx_t *ctx, capture_frame_info_t *info) {
+    replay_t *r = ctx->source_data;
+    buffer_t *buffers = ctx->buffers;
+
+    source_clock_tick(&r->clock, source_count_queued(r->queued, ctx->buffer_count));
+    int index = source_pick_buffer(r->queued, ctx->buffer_count, r->next_buffer);
+    uint32_t sequence;
+    if (index < 0 || !source_clock_due(&r->clock, &sequence)) return -1;
+
+    const replay_frame_t *f = &r->frames[r->next_frame];
+    r->next_frame = (r->next_frame + 1) % r->frame_count;
+
+    buffers[index].start = r->map + f->offset;
+    buffers[index].length = f->size;
+    info->bytesused = f->size;
+    source_clock_stamp(&r->clock, sequence, info);
+    info->sequence = sequence;
+
+    r->queued[index] = false;
+    r->next_buffer = (index + 1) % ctx->buffer_count;
+    return index;
+}
+
+static void replay_requeue(capture_ctx_t *ctx, int index) {
+    replay_t *r = ctx->source_data;
+    if (index >= 0 && index < ctx->buffer_count) r->queued[index] = true;
+}
+
+static bool replay_ready(capture_ctx_t *ctx) {
+    replay_t *r = ctx->source_data;
+    source_clock_tick(&r->clock, source_count_queued(r->queued, ctx->buffer_count));
+    return r->clock.pending > 0;
+}
+
+const capture_source_t capture_source_replay = {
+    .name = "replay",
+    .open = replay_open,
+    .close = replay_close,
+    .dequeue = replay_dequeue,
+    .requeue = replay_requeue,
+    .ready = replay_ready,
+    .set_buffer_count = replay_set_buffer_count,
+};
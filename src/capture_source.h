@@ -0,0 +1,90 @@
+/*
+ * capture_source.h - Capture backend interface
+ *
+ * Each source owns ctx->buffers (an array of buffer_t) and hands out
+ * buffer indices the same way V4L2 does: dequeue returns a filled buffer,
+ * requeue gives it back.
+ */
+
+#ifndef CAPTURE_SOURCE_H
+#define CAPTURE_SOURCE_H
+
+#include "capture.h"
+
+#define CAPTURE_DEQUEUE_ERROR -2
+
+typedef struct {
+    void *start;
+    size_t length;
+    int dmabuf_fd;  // VIDIOC_EXPBUF export of the buffer, -1 = none
+} buffer_t;
+
+typedef struct capture_source {
+    const char *name;
+    bool (*open)(capture_ctx_t *ctx, const char *arg, int width, int height, int num_buffers);
+    void (*close)(capture_ctx_t *ctx);
+    int (*dequeue)(capture_ctx_t *ctx, capture_frame_info_t *info);  // Buffer index, -1 if none ready,
+                                                                      // CAPTURE_DEQUEUE_ERROR if the source failed
+    void (*requeue)(capture_ctx_t *ctx, int index);
+    bool (*ready)(capture_ctx_t *ctx);  // Optional: frame ready without polling wait_fd
+    bool (*set_crop)(capture_ctx_t *ctx, int x, int y, int w, int h);  // Optional: crop in the device
+    bool (*poll_event)(capture_ctx_t *ctx);   // Optional: wait_fd raised POLLPRI, true = input changed
+    bool (*renegotiate)(capture_ctx_t *ctx);  // Optional: pick a new mode for the current input
+    bool (*mode_stale)(capture_ctx_t *ctx);   // Optional: ctx->request now picks another mode
+    bool (*set_buffer_count)(capture_ctx_t *ctx, int num_buffers);  // Optional: rebuild the queue in place
+} capture_source_t;
+
+extern const capture_source_t capture_source_v4l2;
+extern const capture_source_t capture_source_synth;
+extern const capture_source_t capture_source_replay;
+
+// A V4L2 format/size/frame-interval combination
+typedef struct {
+    uint32_t format;
+    int width;
+    int height;
+    uint32_t interval_num;  // Seconds per frame, 0/0 = driver did not say
+    uint32_t interval_den;
+} capture_mode_t;
+
+// Every MJPEG/YUYV mode of the device, caller frees *out
+int v4l2_enum_modes(int fd, int pref_width, int pref_height, capture_mode_t **out);
+double capture_mode_fps(const capture_mode_t *mode);
+double capture_mode_bandwidth(const capture_mode_t *mode, double fps);  // Bytes/s
+
+// Cheapest mode that fits the bus, sustains request->fps and resolves the crop
+const capture_mode_t *capture_pick_mode(const capture_mode_t *modes, int count,
+                                        const capture_request_t *request, double usb_budget);
+
+// Usable isochronous bandwidth of a USB capture device in bytes/s, 0 = unknown
+double v4l2_usb_budget(const char *device);
+
+// Frame pacing for sources that are not driven by hardware: a periodic
+// timerfd the source hands out as ctx->wait_fd so it can be polled like V4L2.
+// Ticks that arrive while the consumer is busy become pending frames, up to
+// the number of queued buffers, like a driver filling its queue.
+typedef struct {
+    int fd;            // -1 = unthrottled
+    uint32_t pending;  // Frames "captured" into queued buffers, not yet dequeued
+    uint32_t ticks;    // Frames "captured" so far, lost ones included
+    uint64_t start_ns;   // When the timer was armed, tick n fires period_ns * (n + 1) later
+    uint64_t period_ns;
+} source_clock_t;
+
+bool source_clock_init(source_clock_t *clock, int fps);
+void source_clock_tick(source_clock_t *clock, int queued_buffers);
+// True when a frame is due, *sequence = its number (the newest frames survive)
+bool source_clock_due(source_clock_t *clock, uint32_t *sequence);
+// Timestamp a due frame with its tick, as a driver stamps the end of the frame.
+// Unthrottled clocks have no ticks: dequeue time, not flagged CAPTURE_TS_DRIVER.
+void source_clock_stamp(const source_clock_t *clock, uint32_t sequence, capture_frame_info_t *info);
+void source_clock_close(source_clock_t *clock);
+
+// Round-robin pick of a queued buffer, -1 if the application holds them all
+int source_pick_buffer(const bool *queued, int count, int start);
+int source_count_queued(const bool *queued, int count);
+
+// Split "ARG@FPS" in place, returns fps or default_fps when absent
+int source_parse_fps(char *arg, int default_fps);
+
+#endif
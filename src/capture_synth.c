@@ -0,0 +1,326 @@
+/*
+ * capture_synth.c - Synthetic capture source
+ *
+ * Generates a moving test pattern laid out like NES Switch Online at 1080p
+ * (black pillarbox, 4x integer upscaled 256x228 game area) so conversion,
+ * auto-detect and rendering can be exercised without a capture card.
+ *
+ *   synth[:yuyv|mjpeg][@FPS]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/videodev2.h>
+#include <jpeglib.h>
+
+#include "capture.h"
+#include "capture_source.h"
+
+#define SYNTH_DEFAULT_FPS 60
+#define SYNTH_MJPEG_CYCLE 60   // Pre-encoded frames, MJPEG loops over these
+#define SYNTH_MJPEG_QUALITY 85
+
+// Game area of the pattern, matches the built-in NES preset
+#define SYNTH_GAME_X 448
+#define SYNTH_GAME_Y 83
+#define SYNTH_NATIVE_W 256
+#define SYNTH_NATIVE_H 228
+#define SYNTH_SCALE 4
+
+#define SYNTH_BORDER_Y 16
+
+typedef struct {
+    uint8_t *data;
+    size_t size;
+} synth_jpeg_t;
+
+typedef struct {
+    source_clock_t clock;
+    uint32_t frame;
+    bool *queued;           // Buffer is owned by the source (available to fill)
+    int next_buffer;
+
+    uint8_t *yuyv;          // Scratch frame for MJPEG encoding
+    synth_jpeg_t *jpegs;
+    int jpeg_count;
+} synth_t;
+
+// A few NES-ish colours as Y, U, V
+static const uint8_t palette[][3] = {
+    { 90, 150, 110},  // Sky blue
+    {150,  90, 170},  // Brick
+    {200, 110, 140},  // Ground
+    { 60, 130, 120},  // Shadow
+    {235, 128, 128},  // White
+};
+
+// Native-resolution pixel of the pattern at frame n
+static const uint8_t *synth_pixel(int x, int y, uint32_t n) {
+    // Moving 16x16 "sprite"
+    int sx = (int)((n * 2) % (SYNTH_NATIVE_W + 16)) - 16;
+    int sy = 100 + (int)((n / 4) % 32);
+    if (x >= sx && x < sx + 16 && y >= sy && y < sy + 16) return palette[4];
+
+    // Scrolling background tiles
+    if (y >= 192) return palette[((x + n) / 16 + y / 16) & 1 ? 2 : 3];
+    if (y < 8) return palette[3];
+    return palette[((x + n / 2) / 32 + y / 32) % 3 == 0 ? 1 : 0];
+}
+
+static void synth_render_yuyv(uint8_t *dst, int width, int height, uint32_t n) {
+    // Border
+    for (int i = 0; i < width * height; i += 2) {
+        dst[i * 2 + 0] = SYNTH_BORDER_Y;
+        dst[i * 2 + 1] = 128;
+        dst[i * 2 + 2] = SYNTH_BORDER_Y;
+        dst[i * 2 + 3] = 128;
+    }
+
+    int game_w = SYNTH_NATIVE_W * SYNTH_SCALE;
+    int game_h = SYNTH_NATIVE_H * SYNTH_SCALE;
+    if (SYNTH_GAME_X + game_w > width || SYNTH_GAME_Y + game_h > height) return;
+
+    // Build one upscaled row per native row, then replicate it
+    for (int ny = 0; ny < SYNTH_NATIVE_H; ny++) {
+        uint8_t *row = dst + ((SYNTH_GAME_Y + ny * SYNTH_SCALE) * width + SYNTH_GAME_X) * 2;
+        for (int nx = 0; nx < SYNTH_NATIVE_W; nx++) {
+            const uint8_t *p = synth_pixel(nx, ny, n);
+            uint8_t *out = row + nx * SYNTH_SCALE * 2;
+            for (int k = 0; k < SYNTH_SCALE; k += 2) {
+                out[k * 2 + 0] = p[0];
+                out[k * 2 + 1] = p[1];
+                out[k * 2 + 2] = p[0];
+                out[k * 2 + 3] = p[2];
+            }
+        }
+        for (int k = 1; k < SYNTH_SCALE; k++) {
+            memcpy(row + k * width * 2, row, game_w * 2);
+        }
+    }
+}
+
+static bool synth_encode_jpeg(const uint8_t *yuyv, int width, int height, synth_jpeg_t *out) {
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+
+    unsigned char *mem = NULL;
+    unsigned long mem_size = 0;
+    jpeg_mem_dest(&cinfo, &mem, &mem_size);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_YCbCr;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, SYNTH_MJPEG_QUALITY, TRUE);
+
+    // 4:2:2 like most capture cards
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 1;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    uint8_t *row = malloc(width * 3);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        const uint8_t *src = yuyv + cinfo.next_scanline * width * 2;
+        for (int x = 0; x < width; x += 2) {
+            row[x * 3 + 0] = src[0];
+            row[x * 3 + 1] = src[1];
+            row[x * 3 + 2] = src[3];
+            row[x * 3 + 3] = src[2];
+            row[x * 3 + 4] = src[1];
+            row[x * 3 + 5] = src[3];
+            src += 4;
+        }
+        JSAMPROW rows[1] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+    }
+    free(row);
+
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    out->data = mem;
+    out->size = mem_size;
+    return mem != NULL;
+}
+
+static void synth_close(capture_ctx_t *ctx) {
+    synth_t *s = ctx->source_data;
+    buffer_t *buffers = ctx->buffers;
+
+    if (buffers) {
+        for (int i = 0; i < ctx->buffer_count; i++) free(buffers[i].start);
+        free(buffers);
+    }
+    if (s) {
+        for (int i = 0; i < s->jpeg_count; i++) free(s->jpegs[i].data);
+        free(s->jpegs);
+        free(s->yuyv);
+        free(s->queued);
+        source_clock_close(&s->clock);
+        free(s);
+    }
+}
+
+static bool synth_open(capture_ctx_t *ctx, const char *arg, int width, int height, int num_buffers) {
+    char opts[64];
+    strncpy(opts, arg, sizeof(opts) - 1);
+    opts[sizeof(opts) - 1] = '\0';
+    int fps = source_parse_fps(opts, SYNTH_DEFAULT_FPS);
+
+    if (opts[0] == '\0' || strcmp(opts, "yuyv") == 0) {
+        ctx->format = V4L2_PIX_FMT_YUYV;
+    } else if (strcmp(opts, "mjpeg") == 0) {
+        ctx->format = V4L2_PIX_FMT_MJPEG;
+    } else {
+        fprintf(stderr, "Unknown synth format '%s' (yuyv or mjpeg)\n", opts);
+        return false;
+    }
+
+    synth_t *s = calloc(1, sizeof(synth_t));
+    if (!s) return false;
+    s->clock.fd = -1;
+    ctx->source_data = s;
+    ctx->width = width & ~1;
+    ctx->height = height;
+    ctx->fps = fps;
+    if (num_buffers < 1) num_buffers = 1;
+
+    size_t frame_size = (size_t)ctx->width * ctx->height * 2;
+
+    if (ctx->format == V4L2_PIX_FMT_MJPEG) {
+        s->yuyv = malloc(frame_size);
+        s->jpegs = calloc(SYNTH_MJPEG_CYCLE, sizeof(synth_jpeg_t));
+        if (!s->yuyv || !s->jpegs) goto error;
+
+        for (int i = 0; i < SYNTH_MJPEG_CYCLE; i++) {
+            synth_render_yuyv(s->yuyv, ctx->width, ctx->height, i);
+            if (!synth_encode_jpeg(s->yuyv, ctx->width, ctx->height, &s->jpegs[i])) goto error;
+            s->jpeg_count++;
+        }
+
+        // Driver-style buffers sized for the largest frame
+        frame_size = 0;
+        for (int i = 0; i < s->jpeg_count; i++) {
+            if (s->jpegs[i].size > frame_size) frame_size = s->jpegs[i].size;
+        }
+    }
+
+    buffer_t *buffers = calloc(num_buffers, sizeof(buffer_t));
+    s->queued = calloc(num_buffers, sizeof(bool));
+    if (!buffers || !s->queued) {
+        free(buffers);
+        goto error;
+    }
+    ctx->buffers = buffers;
+    ctx->buffer_count = num_buffers;
+
+    for (int i = 0; i < num_buffers; i++) {
+        buffers[i].length = frame_size;
+        buffers[i].dmabuf_fd = -1;
+        buffers[i].start = malloc(frame_size);
+        if (!buffers[i].start) goto error;
+        s->queued[i] = true;
+    }
+
+    if (!source_clock_init(&s->clock, fps)) goto error;
+    ctx->wait_fd = s->clock.fd;
+
+    printf("Capture: synthetic %dx%d %.4s @ %d fps (%d buffers)\n",
+           ctx->width, ctx->height, (char*)&ctx->format, fps, num_buffers);
+    return true;
+
+error:
+    fprintf(stderr, "Failed to set up synthetic source\n");
+    synth_close(ctx);
+    ctx->buffers = NULL;
+    ctx->source_data = NULL;
+    return false;
+}
+
+// New queue depth, frames held by the application have all been returned
+static bool synth_set_buffer_count(capture_ctx_t *ctx, int num_buffers) {
+    synth_t *s = ctx->source_data;
+    buffer_t *old = ctx->buffers;
+    size_t frame_size = old[0].length;
+    
+    buffer_t *buffers = calloc(num_buffers, sizeof(buffer_t));
+    bool *queued = calloc(num_buffers, sizeof(bool));
+    bool ok = buffers && queued;
+    for (int i = 0; ok && i < num_buffers; i++) {
+        buffers[i].length = frame_size;
+        buffers[i].dmabuf_fd = -1;
+        buffers[i].start = malloc(frame_size);
+        ok = buffers[i].start != NULL;
+        queued[i] = true;
+    }
+    if (!ok) {
+        for (int i = 0; buffers && i < num_buffers; i++) free(buffers[i].start);
+        free(buffers);
+        free(queued);
+        return false;
+    }
+    
+    for (int i = 0; i < ctx->buffer_count; i++) free(old[i].start);
+    free(old);
+    free(s->queued);
+    ctx->buffers = buffers;
+    ctx->buffer_count = num_buffers;
+    s->queued = queued;
+    s->next_buffer = 0;
+    s->clock.pending = 0;  // Like STREAMON: the new queue starts empty
+    return true;
+}
+
+static int synth_dequeue(capture_ctx_t *ctx, capture_frame_info_t *info) {
+    synth_t *s = ctx->source_data;
+    buffer_t *buffers = ctx->buffers;
+
+    // Like a driver with every buffer held by the application
+    source_clock_tick(&s->clock, source_count_queued(s->queued, ctx->buffer_count));
+    int index = source_pick_buffer(s->queued, ctx->buffer_count, s->next_buffer);
+    uint32_t sequence;
+    if (index < 0 || !source_clock_due(&s->clock, &sequence)) return -1;
+
+    if (ctx->format == V4L2_PIX_FMT_MJPEG) {
+        const synth_jpeg_t *jpeg = &s->jpegs[s->frame % s->jpeg_count];
+        memcpy(buffers[index].start, jpeg->data, jpeg->size);
+        info->bytesused = jpeg->size;
+    } else {
+        synth_render_yuyv(buffers[index].start, ctx->width, ctx->height, s->frame);
+        info->bytesused = buffers[index].length;
+    }
+    source_clock_stamp(&s->clock, sequence, info);
+    info->sequence = sequence;
+
+    s->frame++;
+    s->queued[index] = false;
+    s->next_buffer = (index + 1) % ctx->buffer_count;
+    return index;
+}
+
+static void synth_requeue(capture_ctx_t *ctx, int index) {
+    synth_t *s = ctx->source_data;
+    if (index >= 0 && index < ctx->buffer_count) s->queued[index] = true;
+}
+
+static bool synth_ready(capture_ctx_t *ctx) {
+    synth_t *s = ctx->source_data;
+    source_clock_tick(&s->clock, source_count_queued(s->queued, ctx->buffer_count));
+    return s->clock.pending > 0;
+}
+
+const capture_source_t capture_source_synth = {
+    .name = "synth",
+    .open = synth_open,
+    .close = synth_close,
+    .dequeue = synth_dequeue,
+    .requeue = synth_requeue,
+    .ready = synth_ready,
+    .set_buffer_count = synth_set_buffer_count,
+};
@@ -0,0 +1,169 @@
+/*
+ * decode_pool.c - Worker threads converting captured frames into the mailbox
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "decode_pool.h"
+
+// Hand the converted pixels to the mailbox, in submission order
+static void publish(decode_pool_t *pool, decode_worker_t *worker, const decode_job_t *job,
+                    int width, int height, bool planar, uint64_t capture_ns, uint32_t ts_flags) {
+    mailbox_slot_t *slot = mailbox_write_slot(pool->mailbox);
+
+    // Trade buffers instead of copying: the worker reuses the slot's old one
+    uint8_t *pixels = slot->pixels;
+    size_t capacity = slot->capacity;
+    slot->pixels = worker->pixels;
+    slot->capacity = worker->capacity;
+    worker->pixels = pixels;
+    worker->capacity = capacity;
+
+    slot->width = width;
+    slot->height = height;
+    slot->planar = planar;
+    slot->crop_x = job->crop_x;
+    slot->crop_y = job->crop_y;
+    slot->crop_w = job->crop_w;
+    slot->crop_h = job->crop_h;
+    slot->capture_ns = capture_ns;
+    slot->ts_flags = ts_flags;
+    mailbox_publish(pool->mailbox);
+    pool->published_order = job->order;
+}
+
+static void *worker_main(void *data) {
+    decode_worker_t *worker = data;
+    decode_pool_t *pool = worker->pool;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        while (!pool->has_pending && !pool->stopping) pthread_cond_wait(&pool->changed, &pool->lock);
+        if (!pool->has_pending) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        decode_job_t job = pool->pending;
+        pool->has_pending = false;
+        pool->busy++;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+
+        size_t size = (size_t)job.sw * job.sh * 4;
+        bool converted = size <= worker->capacity;
+        if (!converted) {
+            uint8_t *pixels = realloc(worker->pixels, size);
+            if (pixels) {
+                worker->pixels = pixels;
+                worker->capacity = size;
+                converted = true;
+            }
+        }
+        int scale = 1;
+        bool planar = false;
+        if (converted && job.planar) {
+            scale = capture_decoder_convert_iyuv(worker->decoder, job.frame, worker->pixels,
+                                                 job.sx, job.sy, job.sw, job.sh, job.upscale);
+            planar = scale > 0;
+        }
+        if (converted && !planar) {
+            scale = capture_decoder_convert(worker->decoder, job.frame, worker->pixels,
+                                            job.sx, job.sy, job.sw, job.sh, job.upscale);
+        }
+        uint64_t capture_ns = job.frame->timestamp_ns;
+        uint32_t ts_flags = job.frame->ts_flags;
+        capture_frame_release(job.frame);
+
+        bool published = false;
+        pthread_mutex_lock(&pool->lock);
+        if (converted && job.order > pool->published_order) {
+            int width = job.sw / scale, height = job.sh / scale;
+            if (planar) {
+                width &= ~1;
+                height &= ~1;
+            }
+            publish(pool, worker, &job, width, height, planar, capture_ns, ts_flags);
+            published = true;
+        } else if (converted) {
+            atomic_fetch_add(&pool->superseded, 1);
+        }
+        pool->busy--;
+        pthread_cond_broadcast(&pool->changed);
+        pthread_mutex_unlock(&pool->lock);
+
+        if (published && pool->on_publish) pool->on_publish();
+    }
+    return NULL;
+}
+
+bool decode_pool_init(decode_pool_t *pool, int worker_count, mailbox_t *mailbox, void (*on_publish)(void)) {
+    memset(pool, 0, sizeof(*pool));
+    pool->mailbox = mailbox;
+    pool->on_publish = on_publish;
+    atomic_init(&pool->replaced, 0);
+    atomic_init(&pool->superseded, 0);
+    if (worker_count > DECODE_POOL_MAX_WORKERS) worker_count = DECODE_POOL_MAX_WORKERS;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->changed, NULL);
+
+    for (int i = 0; i < worker_count; i++) {
+        decode_worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->decoder = capture_decoder_create();
+        if (!worker->decoder || pthread_create(&worker->thread, NULL, worker_main, worker) != 0) {
+            capture_decoder_destroy(worker->decoder);
+            worker->decoder = NULL;
+            fprintf(stderr, "Failed to start decode worker %d\n", i);
+            break;
+        }
+        pool->worker_count++;
+    }
+
+    if (pool->worker_count == 0) {
+        decode_pool_destroy(pool);
+        return false;
+    }
+    return true;
+}
+
+void decode_pool_destroy(decode_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+
+    // Workers finish the waiting frame before they exit
+    for (int i = 0; i < pool->worker_count; i++) {
+        pthread_join(pool->workers[i].thread, NULL);
+        capture_decoder_destroy(pool->workers[i].decoder);
+        free(pool->workers[i].pixels);
+    }
+    pool->worker_count = 0;
+
+    pthread_cond_destroy(&pool->changed);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+void decode_pool_submit(decode_pool_t *pool, const decode_job_t *job, bool wait) {
+    pthread_mutex_lock(&pool->lock);
+    while (wait && pool->has_pending) pthread_cond_wait(&pool->changed, &pool->lock);
+
+    if (pool->has_pending) {
+        capture_frame_release(pool->pending.frame);
+        atomic_fetch_add(&pool->replaced, 1);
+    }
+    pool->pending = *job;
+    pool->pending.order = ++pool->next_order;
+    pool->has_pending = true;
+    pthread_cond_broadcast(&pool->changed);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void decode_pool_drain(decode_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->has_pending || pool->busy) pthread_cond_wait(&pool->changed, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
@@ -0,0 +1,75 @@
+/*
+ * decode_pool.h - Worker threads converting captured frames into the mailbox
+ *
+ * The capture thread hands acquired frames over and goes back to the driver
+ * while workers decode, each with its own MJPEG decoder and output buffer.
+ * A finished frame is swapped into the mailbox's write slot (no copy) unless
+ * a newer frame was published first, so the display never goes backwards.
+ * With every worker busy, a newer frame replaces the one waiting for a
+ * worker (latest wins), or the submitter waits when every frame should show.
+ */
+
+#ifndef DECODE_POOL_H
+#define DECODE_POOL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "capture.h"
+#include "mailbox.h"
+
+#define DECODE_POOL_MAX_WORKERS 8
+
+typedef struct {
+    capture_frame_t *frame;  // Reference handed over with the job, released by the worker
+    int sx, sy, sw, sh;      // Crop in the frame's pixels
+    int upscale;             // Content upscale for capture_decoder_convert
+    bool planar;             // I420 for a YUV texture where the frame allows it, else RGBA
+    int crop_x, crop_y, crop_w, crop_h;  // Same crop in reference pixels, for the slot
+    uint64_t order;          // Submission order, set by the pool
+} decode_job_t;
+
+struct decode_pool;
+
+typedef struct {
+    struct decode_pool *pool;
+    pthread_t thread;
+    capture_decoder_t *decoder;
+    uint8_t *pixels;         // Output buffer, traded with the mailbox slot on publish
+    size_t capacity;
+} decode_worker_t;
+
+typedef struct decode_pool {
+    mailbox_t *mailbox;
+    void (*on_publish)(void);  // Called after each publish, outside the lock
+
+    decode_worker_t workers[DECODE_POOL_MAX_WORKERS];
+    int worker_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;  // Job queued, taken or finished
+    decode_job_t pending;
+    bool has_pending;
+    int busy;                // Workers converting
+    bool stopping;
+    uint64_t next_order;
+    uint64_t published_order;  // Newest job in the mailbox
+
+    atomic_ullong replaced;    // Waiting frames replaced by newer ones before a worker took them
+    atomic_ullong superseded;  // Converted but dropped, a newer frame was already published
+} decode_pool_t;
+
+// Start worker_count threads publishing into mailbox (its single writer from now on)
+bool decode_pool_init(decode_pool_t *pool, int worker_count, mailbox_t *mailbox, void (*on_publish)(void));
+void decode_pool_destroy(decode_pool_t *pool);
+
+// Queue a frame for conversion. wait = block until a worker can take it instead
+// of replacing a frame that is still waiting.
+void decode_pool_submit(decode_pool_t *pool, const decode_job_t *job, bool wait);
+
+// Wait until every submitted frame is converted and released
+void decode_pool_drain(decode_pool_t *pool);
+
+#endif
@@ -0,0 +1,110 @@
+/*
+ * grid.c - Pixel grid detection for upscaled content
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "grid.h"
+
+#define GRID_EDGE_THRESHOLD 16   // Luma step that counts as a cell edge, above capture noise
+#define GRID_DECAY 0.7f          // Weight left to earlier frames' edges at each new frame
+#define GRID_MIN_EDGES 64.0f     // Evidence needed before estimating
+#define GRID_MIN_COHERENCE 0.6   // 1 = every edge exactly on the grid
+#define GRID_STEPS (GRID_MAX_SCALE - GRID_MIN_SCALE + 1)
+
+void grid_axis_reset(grid_axis_t *axis) {
+    memset(axis, 0, sizeof(*axis));
+}
+
+void grid_axis_begin_frame(grid_axis_t *axis) {
+    for (int i = 0; i < GRID_MAX_POS; i++) axis->edges[i] *= GRID_DECAY;
+    axis->total *= GRID_DECAY;
+}
+
+void grid_axis_add_line(grid_axis_t *axis, const uint8_t *luma, int origin, int count) {
+    // One edge per luma step, at its steepest point: a scaler that blurs cell
+    // edges over two pixels still gives one position per edge
+    int prev = 0;
+    for (int i = 1; i < count; i++) {
+        int diff = luma[i] - luma[i - 1];
+        if (diff < 0) diff = -diff;
+        int next = 0;
+        if (i + 1 < count) {
+            next = luma[i + 1] - luma[i];
+            if (next < 0) next = -next;
+        }
+        int pos = origin + i;
+        if (diff > GRID_EDGE_THRESHOLD && diff >= prev && diff > next && pos >= 0 && pos < GRID_MAX_POS) {
+            axis->edges[pos] += 1.0f;
+            axis->total += 1.0f;
+        }
+        prev = diff;
+    }
+}
+
+bool grid_axis_estimate(const grid_axis_t *axis, int keep, grid_estimate_t *out) {
+    if (axis->total < GRID_MIN_EDGES) return false;
+
+    int first = 0, last = GRID_MAX_POS - 1;
+    while (first < last && axis->edges[first] == 0) first++;
+    while (last > first && axis->edges[last] == 0) last--;
+
+    // Wrap the positions around a circle as long as each candidate period:
+    // edges a whole number of periods apart land on the same angle, and the
+    // length of their mean vector says how well they line up
+    double re[GRID_STEPS], im[GRID_STEPS], coherence[GRID_STEPS];
+    for (int k = 0; k < GRID_STEPS; k++) {
+        double step = 2.0 * M_PI * GRID_ONE / (GRID_MIN_SCALE + k);
+        double c = cos(step), s = sin(step);
+        double pr = cos(step * first), pi = sin(step * first);
+        double sum_re = 0, sum_im = 0;
+        for (int x = first; x <= last; x++) {
+            float w = axis->edges[x];
+            if (w != 0) {
+                sum_re += w * pr;
+                sum_im += w * pi;
+            }
+            double t = pr * c - pi * s;
+            pi = pr * s + pi * c;
+            pr = t;
+        }
+        re[k] = sum_re;
+        im[k] = sum_im;
+        coherence[k] = sqrt(sum_re * sum_re + sum_im * sum_im) / axis->total;
+    }
+
+    // Edges of cells of size T also line up at T/2, T/3... but not at 2T, where
+    // every other cell edge sits half a turn away: the largest period that
+    // lines up is the cell size. Its peak is the best fit just below.
+    int top = -1;
+    for (int k = GRID_STEPS - 1; k >= 0 && top < 0; k--) {
+        if (coherence[k] >= GRID_MIN_COHERENCE) top = k;
+    }
+    if (top < 0) return false;
+    int best = top;
+    for (int k = top; k >= 0 && k > top - GRID_ONE / 2; k--) {
+        if (coherence[k] > coherence[best]) best = k;
+    }
+
+    // Integer upscales come out a step off when few edges are in; snap them
+    int whole = (GRID_MIN_SCALE + best + GRID_ONE / 2) / GRID_ONE * GRID_ONE - GRID_MIN_SCALE;
+    if (abs(whole - best) <= 1 && whole < GRID_STEPS && coherence[whole] >= GRID_MIN_COHERENCE) best = whole;
+
+    int kept = keep - GRID_MIN_SCALE;
+    if (kept >= 0 && kept < best && (GRID_MIN_SCALE + best) % keep == 0 &&
+        coherence[kept] >= GRID_MIN_COHERENCE) {
+        best = kept;
+    }
+
+    int scale = GRID_MIN_SCALE + best;
+    int phase = (int)lround(atan2(im[best], re[best]) / (2.0 * M_PI) * scale);
+    phase %= scale;
+    if (phase < 0) phase += scale;
+
+    out->scale = scale;
+    out->phase = phase;
+    out->confidence = (float)coherence[best];
+    return true;
+}
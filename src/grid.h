@@ -0,0 +1,52 @@
+/*
+ * grid.h - Pixel grid detection for upscaled content
+ *
+ * Retro content reaches the capture card as native pixels blown up into
+ * cells of (roughly) equal size. Along a line through the picture, luma
+ * changes only where one cell ends and the next starts, so the positions of
+ * those edges repeat with the cell size. Each axis collects edge positions
+ * from luma profiles over a few frames and finds the period the edges line
+ * up with best: the upscale factor, integer or not, and the phase, where
+ * cells start. Positions are in the caller's coordinates, the same for every
+ * line and frame (1080p reference pixels in capturedisp).
+ */
+
+#ifndef GRID_H
+#define GRID_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define GRID_ONE 16          // Scale and phase are fixed point, 1/16 pixel
+#define GRID_MIN_SCALE (2 * GRID_ONE)
+#define GRID_MAX_SCALE (8 * GRID_ONE)
+#define GRID_MAX_POS 2048    // Positions 0..GRID_MAX_POS-1
+
+typedef struct {
+    float edges[GRID_MAX_POS];  // Edge evidence per position, older frames fading
+    float total;
+} grid_axis_t;
+
+typedef struct {
+    int scale;               // Cell size, GRID_ONE = not upscaled
+    int phase;               // A cell starts here, 0 <= phase < scale
+    float confidence;        // How well the edges line up, 0..1
+} grid_estimate_t;
+
+void grid_axis_reset(grid_axis_t *axis);
+
+// Start a frame: evidence collected so far counts for less from now on
+void grid_axis_begin_frame(grid_axis_t *axis);
+
+// Add the luma profile of one line: luma[i] is at position origin + i
+void grid_axis_add_line(grid_axis_t *axis, const uint8_t *luma, int origin, int count);
+
+// Period the edges repeat with, between GRID_MIN_SCALE and GRID_MAX_SCALE.
+// Content whose edges all fall on every other cell (2x2 tiles, coarse test
+// patterns) also fits twice the cell size; a multiple of `keep` (the current
+// scale, 0 = none) wins over it only when `keep` no longer fits, since too small
+// a scale costs speed while too large a one loses detail.
+// False when there are too few edges or none lines up well enough.
+bool grid_axis_estimate(const grid_axis_t *axis, int keep, grid_estimate_t *out);
+
+#endif
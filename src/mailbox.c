@@ -0,0 +1,65 @@
+/*
+ * mailbox.c - Lock-free newest-wins frame handoff between two threads
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "mailbox.h"
+
+#define MAILBOX_FRESH 0x100u
+#define MAILBOX_INDEX 0x0FFu
+
+void mailbox_init(mailbox_t *mb) {
+    memset(mb, 0, sizeof(*mb));
+    mb->write_index = 0;
+    mb->read_index = 1;
+    atomic_init(&mb->ready, 2);
+    atomic_init(&mb->published, 0);
+    atomic_init(&mb->overwritten, 0);
+    mb->next_sequence = 1;
+}
+
+void mailbox_destroy(mailbox_t *mb) {
+    for (int i = 0; i < MAILBOX_SLOTS; i++) {
+        free(mb->slots[i].pixels);
+        mb->slots[i].pixels = NULL;
+        mb->slots[i].capacity = 0;
+    }
+}
+
+mailbox_slot_t *mailbox_write_slot(mailbox_t *mb) {
+    return &mb->slots[mb->write_index];
+}
+
+bool mailbox_slot_reserve(mailbox_slot_t *slot, size_t size) {
+    if (slot->capacity >= size) return true;
+
+    uint8_t *pixels = realloc(slot->pixels, size);
+    if (!pixels) return false;
+    slot->pixels = pixels;
+    slot->capacity = size;
+    return true;
+}
+
+void mailbox_publish(mailbox_t *mb) {
+    mb->slots[mb->write_index].sequence = mb->next_sequence++;
+
+    // Release: slot contents must be visible before the reader can take it
+    unsigned old = atomic_exchange_explicit(&mb->ready, mb->write_index | MAILBOX_FRESH,
+                                            memory_order_acq_rel);
+    mb->write_index = old & MAILBOX_INDEX;
+
+    atomic_fetch_add_explicit(&mb->published, 1, memory_order_relaxed);
+    if (old & MAILBOX_FRESH) {
+        atomic_fetch_add_explicit(&mb->overwritten, 1, memory_order_relaxed);
+    }
+}
+
+mailbox_slot_t *mailbox_take(mailbox_t *mb) {
+    if (!(atomic_load_explicit(&mb->ready, memory_order_relaxed) & MAILBOX_FRESH)) return NULL;
+
+    unsigned old = atomic_exchange_explicit(&mb->ready, mb->read_index, memory_order_acq_rel);
+    mb->read_index = old & MAILBOX_INDEX;
+    return &mb->slots[mb->read_index];
+}
@@ -0,0 +1,60 @@
+/*
+ * mailbox.h - Lock-free newest-wins frame handoff between two threads
+ *
+ * Triple buffer: the writer always has a private slot to fill, the reader
+ * always has a private slot to display, and the third slot sits in the
+ * mailbox. Publishing swaps the writer's slot into the mailbox; taking
+ * swaps the reader's slot out. Neither side ever waits on the other, and
+ * a frame the reader never picked up is simply overwritten.
+ */
+
+#ifndef MAILBOX_H
+#define MAILBOX_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define MAILBOX_SLOTS 3
+
+typedef struct {
+    uint8_t *pixels;
+    size_t capacity;
+
+    int width;          // Pixel size of the converted frame
+    int height;
+    bool planar;        // I420 planes (Y, then U and V at half size) instead of RGBA
+    int crop_x;         // Crop it was converted from (reference pixels)
+    int crop_y;
+    int crop_w;
+    int crop_h;
+    uint64_t capture_ns;  // CLOCK_MONOTONIC capture timestamp of the source frame
+    uint32_t ts_flags;    // CAPTURE_TS_* of capture_ns
+    uint64_t sequence;    // Publish order, starts at 1
+} mailbox_slot_t;
+
+typedef struct {
+    mailbox_slot_t slots[MAILBOX_SLOTS];
+    atomic_uint ready;          // Slot index in the mailbox | MAILBOX_FRESH
+
+    int write_index;            // Owned by the writer
+    int read_index;             // Owned by the reader
+    uint64_t next_sequence;     // Owned by the writer
+
+    atomic_ullong published;
+    atomic_ullong overwritten;  // Published but replaced before the reader took it
+} mailbox_t;
+
+void mailbox_init(mailbox_t *mb);
+void mailbox_destroy(mailbox_t *mb);
+
+// Writer side
+mailbox_slot_t *mailbox_write_slot(mailbox_t *mb);
+bool mailbox_slot_reserve(mailbox_slot_t *slot, size_t size);
+void mailbox_publish(mailbox_t *mb);
+
+// Reader side: newest frame not seen yet, or NULL
+mailbox_slot_t *mailbox_take(mailbox_t *mb);
+
+#endif
@@ -11,15 +11,32 @@
 #include <signal.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <stdatomic.h>
+#include <sys/eventfd.h>
 
+#include <linux/videodev2.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
 #include "capture.h"
 #include "config.h"
+#include "decode_pool.h"
+#include "grid.h"
+#include "mailbox.h"
+#include "telemetry.h"
 
 #define WINDOW_TITLE "capturedisp"
 
+#define CAPTURE_WAIT_MS 100   // Capture thread re-checks UI requests at least this often
+#define CAPTURE_REOPEN_MS 1000  // Retry period while a failed capture device is gone
+#define RENDER_IDLE_MS 250    // Redraw the OSD at least this often without frames
+#define STATS_LOG_MS 5000     // Period of the latency log line
+
+// Crops, presets and detectors use 1080p coordinates, whatever mode the card runs in
+#define REF_W 1920
+#define REF_H 1080
+#define CONTENT_UPSCALE 4  // Retro content is native pixels integer-scaled 4x in 1080p, until grid.c measures it
+
 // NES Switch Online 1080p capture parameters (built-in preset)
 #define NES_CROP_X 448
 #define NES_CROP_Y 83
@@ -28,7 +45,7 @@
 #define NES_NATIVE_W 256
 #define NES_NATIVE_H 228
 
-// Current crop settings (can be changed by presets)
+// Current crop settings (can be changed by presets) - owned by the capture thread
 static int crop_x = NES_CROP_X;
 static int crop_y = NES_CROP_Y;
 static int crop_w = NES_CROP_W;
@@ -63,15 +80,61 @@ static TTF_Font *font = NULL;
 static scale_mode_t scale_mode = SCALE_SMOOTH;
 static color_mode_t color_mode = COLOR_PAL60;
 static bool current_240p_mode = false;
-static capture_ctx_t *capture = NULL;
+static capture_ctx_t *capture = NULL;  // Owned by the capture thread once it runs
+static const char *capture_device = "/dev/video0";
 static ui_mode_t ui_mode = UI_NORMAL;
-static bool auto_detect = true;
-static detected_preset_t last_detected = PRESET_NONE;
+static atomic_bool auto_detect = true;
+static atomic_int last_detected = PRESET_NONE;
 static int detect_cooldown = 0;  // Frames until next detection
+
+// Pixel grid of the content in the crop (grid.c): cell size and where cells start,
+// in reference pixels and GRID_ONE units. Measured on the capture thread.
+#define GRID_LINES 8           // Rows and columns of the crop analysed per frame
+#define GRID_RETRY_FRAMES 5    // Analysis period until the grid is known
+#define GRID_FRAMES 30         // and after, following changes
+static grid_axis_t grid_x, grid_y;
+static int grid_cooldown = 0;  // Frames until the next grid analysis
+static bool grid_settled = false;
+static atomic_int content_scale_x = CONTENT_UPSCALE * GRID_ONE;  // Render thread reads these two
+static atomic_int content_scale_y = CONTENT_UPSCALE * GRID_ONE;
+static int content_phase_x = 0;
+static int content_phase_y = 0;
 static int last_border_luma[4] = {0};  // Track border brightness to detect actual changes
-static bool pending_border_scan = false;  // D key pressed, scan on next frame
-static int buffer_count = 2;  // V4L2 buffer count (1-4, lower = less latency)
-static bool pending_buffer_change = false;
+static atomic_bool pending_border_scan = false;  // D key pressed, scan on next frame
+static atomic_int buffer_count = 2;  // V4L2 buffer count (1-4, lower = less latency)
+static atomic_bool pending_buffer_change = false;
+static atomic_bool auto_buffers = false;  // Tune buffer_count from dropped frames
+static atomic_bool latest_only = true;  // Drain the queue and show only the newest frame
+static bool use_userptr = false;  // Capture into our own huge-page pool instead of driver buffers
+static bool planar_output = false;  // Hand frames over as I420, the GPU converts to RGB
+static atomic_ullong stale_skipped = 0;  // Frames drained unseen by latest-only mode
+static atomic_ullong frames_dequeued = 0;  // Mirrors of capture->stats for the render thread
+static atomic_ullong frames_dropped = 0;
+static atomic_ullong frames_errored = 0;
+static atomic_ullong frames_repeated = 0;
+static atomic_ullong frames_duplicate = 0;  // Identical to the frame on screen, not converted
+
+// Capture thread -> render thread
+static mailbox_t mailbox;  // Converted frames, newest wins
+static decode_pool_t decode_pool;  // Converts frames off the capture thread, publishes to the mailbox
+static int decode_threads = 2;  // Decode pool workers, 0 = convert on the capture thread
+static int convert_threads = 0;  // Row-band threads per YUYV conversion, 0 = one per core
+static bool native_average = false;  // Native YUYV pixels are cell means rather than middle samples
+static Uint32 frame_event_type;  // SDL user event announcing a published frame
+static atomic_bool frame_event_pending = false;  // One announcement in the SDL queue at a time
+static atomic_int pending_video_mode = -1;  // Auto-detect wants 240p (1) or 480i (0)
+static atomic_bool pending_crop_saved = false;  // Border scan picked a new crop, copy it to config
+
+// Render thread -> capture thread
+static atomic_ullong pending_crop = 0;  // Preset crop, see pack_crop()
+static atomic_bool pending_refresh = false;  // Texture lost its pixels, resend even a duplicate frame
+static int wake_fd = -1;  // eventfd interrupting the capture thread's wait for a frame
+
+// Crop shown on screen, render thread copy of the capture thread's crop
+static latency_stats_t latency;  // Capture-to-present, render thread only
+static latency_summary_t latency_summary;  // Refreshed once a second for the OSD
+static uint64_t frames_presented = 0;  // Render thread only
+static SDL_Rect shown_crop = {NES_CROP_X, NES_CROP_Y, NES_CROP_W, NES_CROP_H};
 
 // Preset menu state
 static char **preset_names = NULL;
@@ -110,10 +173,44 @@ void signal_handler(int sig) {
     running = false;
 }
 
-// Sample a YUYV pixel and return Y (luma) value
-static inline int sample_yuyv_luma(const uint8_t *yuyv, int width, int x, int y) {
+// Frame handed to the detectors: raw YUYV, or decoded RGBA for MJPEG sources.
+// Detectors work in reference coordinates (width x height), sampling maps them
+// to the negotiated mode and from there into the data, which is only part of
+// the mode's frame when the device crops.
+typedef struct {
+    const uint8_t *data;
+    int width;       // Reference size
+    int height;
+    int source_w;    // Negotiated mode size
+    int source_h;
+    int origin_x;    // Position of data in the mode's frame
+    int origin_y;
+    int data_w;      // Pixel size of data
+    int data_h;
+    bool rgba;
+} frame_view_t;
+
+// Device crop probes: every point border_changed() and detect_preset() sample
+#define DETECT_AREA_X 400
+#define DETECT_AREA_Y 83
+#define DETECT_AREA_W 1121
+#define DETECT_AREA_H 718
+
+// Sample a pixel and return Y (luma) value
+static inline int sample_luma(const frame_view_t *frame, int x, int y) {
+    if (frame->source_w != frame->width || frame->origin_x || frame->origin_y) {
+        x = x * frame->source_w / frame->width - frame->origin_x;
+        y = y * frame->source_h / frame->height - frame->origin_y;
+    }
+    if (x < 0) x = 0; else if (x >= frame->data_w) x = frame->data_w - 1;
+    if (y < 0) y = 0; else if (y >= frame->data_h) y = frame->data_h - 1;
+    
+    if (frame->rgba) {
+        const uint8_t *p = frame->data + (y * frame->data_w + x) * 4;
+        return (77 * p[0] + 150 * p[1] + 29 * p[2]) >> 8;
+    }
     // YUYV: Y0 U Y1 V - each pixel pair is 4 bytes
-    return yuyv[(y * width + x) * 2];
+    return frame->data[(y * frame->data_w + x) * 2];
 }
 
 // Sample RGB from YUYV at a point
@@ -134,12 +231,12 @@ static void sample_yuyv_rgb(const uint8_t *yuyv, int width, int x, int y, int *r
 
 // Auto-detect which preset to use based on border analysis
 // Returns true if border has changed significantly (worth re-evaluating)
-static bool border_changed(const uint8_t *yuyv, int width, detected_preset_t current) {
+static bool border_changed(const frame_view_t *frame, detected_preset_t current) {
     int samples[4];
-    samples[0] = sample_yuyv_luma(yuyv, width, 400, 200);
-    samples[1] = sample_yuyv_luma(yuyv, width, 400, 400);
-    samples[2] = sample_yuyv_luma(yuyv, width, 400, 600);
-    samples[3] = sample_yuyv_luma(yuyv, width, 400, 800);
+    samples[0] = sample_luma(frame, 400, 200);
+    samples[1] = sample_luma(frame, 400, 400);
+    samples[2] = sample_luma(frame, 400, 600);
+    samples[3] = sample_luma(frame, 400, 800);
     
     int diff = 0;
     for (int i = 0; i < 4; i++) {
@@ -158,22 +255,36 @@ static bool border_changed(const uint8_t *yuyv, int width, detected_preset_t cur
     return diff > 60;  // ~15 per sample average
 }
 
+// Span start..end (reference pixels) grown to whole cells of one grid axis:
+// start moves back to where its cell starts, size covers the last cell
+static void grid_snap(int *start, int *size, int end, int scale, int phase) {
+    int cells = (*start * GRID_ONE - phase) / scale;
+    if (cells * scale + phase > *start * GRID_ONE) cells--;  // Division rounded a negative up
+    int first = cells * scale + phase;
+    int count = (end * GRID_ONE - first + scale - 1) / scale;
+    *start = (first + GRID_ONE / 2) / GRID_ONE;
+    *size = (first + count * scale + GRID_ONE / 2) / GRID_ONE - *start;
+}
+
 // Scan frame to detect game area borders automatically
 // Returns true if a bordered game area was found
-static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
+static bool scan_for_game_area(const frame_view_t *frame,
                                 int *out_x, int *out_y, int *out_w, int *out_h) {
+    const int width = frame->width;
+    const int height = frame->height;
+    
     // The "black" border might be dithered dark gray (~luma 20-25)
     // Content threshold needs to be higher
     const int content_threshold = 40;
     const int border_threshold = 30;  // Below this is considered border
     
     // First, sample the border area to get baseline darkness
-    int border_luma = sample_yuyv_luma(yuyv, width, 200, height / 2);
+    int border_luma = sample_luma(frame, 200, height / 2);
     
     // Scan from left to find where content starts (skip first 150px for P1 icon)
     int left_edge = 0;
     for (int x = 150; x < width / 2; x += 2) {
-        int luma = sample_yuyv_luma(yuyv, width, x, height / 2);
+        int luma = sample_luma(frame, x, height / 2);
         if (luma > content_threshold && luma > border_luma + 15) {
             left_edge = x;
             break;
@@ -183,7 +294,7 @@ static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
     // Scan from right
     int right_edge = width;
     for (int x = width - 150; x > width / 2; x -= 2) {
-        int luma = sample_yuyv_luma(yuyv, width, x, height / 2);
+        int luma = sample_luma(frame, x, height / 2);
         if (luma > content_threshold && luma > border_luma + 15) {
             right_edge = x + 1;
             break;
@@ -196,7 +307,7 @@ static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
     
     int top_edge = 0;
     for (int y = 120; y < height / 2; y += 2) {
-        int luma = sample_yuyv_luma(yuyv, width, center_x, y);
+        int luma = sample_luma(frame, center_x, y);
         if (luma > content_threshold && luma > border_luma + 15) {
             top_edge = y;
             break;
@@ -207,7 +318,7 @@ static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
     int scan_x_bottom = left_edge > 0 ? left_edge + 50 : width / 3;
     int bottom_edge = height;
     for (int y = height - 100; y > height / 2; y -= 2) {
-        int luma = sample_yuyv_luma(yuyv, width, scan_x_bottom, y);
+        int luma = sample_luma(frame, scan_x_bottom, y);
         if (luma > content_threshold && luma > border_luma + 15) {
             bottom_edge = y + 1;
             break;
@@ -225,11 +336,9 @@ static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
         return false;  // No clear border found
     }
     
-    // Snap to 4-pixel boundaries (for clean scaling)
-    left_edge = (left_edge) & ~3;
-    top_edge = (top_edge) & ~3;
-    detected_w = ((right_edge - left_edge) + 3) & ~3;
-    detected_h = ((bottom_edge - top_edge) + 3) & ~3;
+    // Snap to whole cells of the pixel grid (for clean scaling)
+    grid_snap(&left_edge, &detected_w, right_edge, content_scale_x, content_phase_x);
+    grid_snap(&top_edge, &detected_h, bottom_edge, content_scale_y, content_phase_y);
     
     *out_x = left_edge;
     *out_y = top_edge;
@@ -239,18 +348,16 @@ static bool scan_for_game_area(const uint8_t *yuyv, int width, int height,
     return true;
 }
 
-static detected_preset_t detect_preset(const uint8_t *yuyv, int width, int height) {
-    (void)height;
-    
+static detected_preset_t detect_preset(const frame_view_t *frame) {
     // Check if we have black border at x=400 (inside margin, outside game)
     // If this area is NOT black, we're probably on Switch menu
-    int border_y1 = sample_yuyv_luma(yuyv, width, 400, 300);
-    int border_y2 = sample_yuyv_luma(yuyv, width, 400, 500);
-    int border_y3 = sample_yuyv_luma(yuyv, width, 400, 700);
+    int border_y1 = sample_luma(frame, 400, 300);
+    int border_y2 = sample_luma(frame, 400, 500);
+    int border_y3 = sample_luma(frame, 400, 700);
     // Also check the right side border
-    int border_y4 = sample_yuyv_luma(yuyv, width, 1520, 300);
-    int border_y5 = sample_yuyv_luma(yuyv, width, 1520, 500);
-    int border_y6 = sample_yuyv_luma(yuyv, width, 1520, 700);
+    int border_y4 = sample_luma(frame, 1520, 300);
+    int border_y5 = sample_luma(frame, 1520, 500);
+    int border_y6 = sample_luma(frame, 1520, 700);
     
     // If border area is not dark on BOTH sides, probably Switch menu - no crop
     // Need all 6 samples to be dark (< 25) to detect as bordered game
@@ -261,8 +368,8 @@ static detected_preset_t detect_preset(const uint8_t *yuyv, int width, int heigh
     
     // Border is black on both sides - we're in a game. Now detect NES vs SNES.
     // Check y=85 at center - NES has game content here, SNES still has border
-    int y85_luma = sample_yuyv_luma(yuyv, width, 700, 85);
-    int y95_luma = sample_yuyv_luma(yuyv, width, 700, 95);
+    int y85_luma = sample_luma(frame, 700, 85);
+    int y95_luma = sample_luma(frame, 700, 95);
     
     // NES game area starts at y=83, so y=85 should have content (non-black)
     // SNES game area starts at y=92, so y=85 is still black border
@@ -277,11 +384,11 @@ static detected_preset_t detect_preset(const uint8_t *yuyv, int width, int heigh
     
     // Black screen in game area - could be loading, default to NES
     // Or check more samples to be sure
-    int center_luma = sample_yuyv_luma(yuyv, width, 960, 540);
+    int center_luma = sample_luma(frame, 960, 540);
     if (center_luma > 10) {
         // There's something in center, check the game height
         // Scan down from y=83 to find content
-        int nes_start = sample_yuyv_luma(yuyv, width, 700, 83);
+        int nes_start = sample_luma(frame, 700, 83);
         if (nes_start > 15) {
             return PRESET_NES_SWITCH;
         }
@@ -308,48 +415,480 @@ static void apply_detected_preset(detected_preset_t preset,
     }
 }
 
-// YUYV to RGBA conversion - scalar version (reliable and fast with -O3)
-static void yuyv_crop_to_rgba(const uint8_t *src, int src_w, int src_h,
-                               uint8_t *dst, 
-                               int crop_x, int crop_y, int crop_w, int crop_h) {
-    (void)src_h;
-    crop_x &= ~1;
+// Crop requests are packed into one word so the capture thread picks up all four at once
+#define CROP_REQUEST_VALID (1ull << 63)
+
+static uint64_t pack_crop(int x, int y, int w, int h) {
+    return CROP_REQUEST_VALID |
+           ((uint64_t)(x & 0xFFFF) << 48) | ((uint64_t)(y & 0xFFFF) << 32) |
+           ((uint64_t)(w & 0xFFFF) << 16) | (uint64_t)(h & 0xFFFF);
+}
+
+static void unpack_crop(uint64_t packed, int *x, int *y, int *w, int *h) {
+    *x = (packed >> 48) & 0x7FFF;
+    *y = (packed >> 32) & 0xFFFF;
+    *w = (packed >> 16) & 0xFFFF;
+    *h = packed & 0xFFFF;
+}
+
+// Let the capture thread act on a UI request without waiting for the next frame
+static void wake_capture_thread(void) {
+    if (wake_fd >= 0) eventfd_write(wake_fd, 1);
+}
+
+// The grid is measured on upscaled content only, 16:9 content is shown as is
+static bool grid_due(void) {
+    return grid_cooldown <= 0 && (crop_w != REF_W || crop_h != REF_H);
+}
+
+// analyze_frame() will look at pixels this frame (border scan, auto-detect or pixel grid)
+static bool detectors_due(void) {
+    return pending_border_scan || (auto_detect && detect_cooldown <= 0) || grid_due();
+}
+
+// One frame closer to the next detector run, for frames the detectors do not see
+static void count_down_detectors(void) {
+    if (detect_cooldown > 0) detect_cooldown--;
+    if (grid_cooldown > 0) grid_cooldown--;
+}
+
+// New content in the crop: measure its grid from scratch, keeping the last
+// estimate until the first new one
+static void reset_grid(void) {
+    grid_axis_reset(&grid_x);
+    grid_axis_reset(&grid_y);
+    grid_settled = false;
+    grid_cooldown = 0;
+}
+
+// Phase moved by more than a quarter pixel, either way round the cell
+static bool grid_phase_moved(int old_phase, int new_phase, int scale) {
+    int moved = abs(new_phase - old_phase);
+    if (moved > scale - moved) moved = scale - moved;
+    return moved > GRID_ONE / 4;
+}
+
+// Cell size and phase of the content from luma edges along rows and columns
+// of the crop; the axes weigh the last few analyses, so noise and a frame
+// without much detail do not throw the estimate
+static void analyze_grid(const frame_view_t *frame) {
+    uint8_t line[REF_W];
     
-    for (int y = 0; y < crop_h; y++) {
-        const uint8_t *row = src + ((crop_y + y) * src_w + crop_x) * 2;
-        uint8_t *out = dst + y * crop_w * 4;
+    grid_axis_begin_frame(&grid_x);
+    grid_axis_begin_frame(&grid_y);
+    for (int i = 1; i <= GRID_LINES; i++) {
+        int row = crop_y + crop_h * i / (GRID_LINES + 1);
+        for (int x = 0; x < crop_w; x++) line[x] = sample_luma(frame, crop_x + x, row);
+        grid_axis_add_line(&grid_x, line, crop_x, crop_w);
         
-        for (int x = 0; x < crop_w; x += 2) {
-            int y0 = row[0];
-            int u  = row[1];
-            int y1 = row[2];
-            int v  = row[3];
-            row += 4;
+        int column = crop_x + crop_w * i / (GRID_LINES + 1);
+        for (int y = 0; y < crop_h; y++) line[y] = sample_luma(frame, column, crop_y + y);
+        grid_axis_add_line(&grid_y, line, crop_y, crop_h);
+    }
+    
+    grid_estimate_t ex, ey;
+    if (!grid_axis_estimate(&grid_x, content_scale_x, &ex) || !grid_axis_estimate(&grid_y, content_scale_y, &ey)) return;
+    bool rescaled = !grid_settled || ex.scale != content_scale_x || ey.scale != content_scale_y;
+    if (rescaled) {
+        printf("Pixel grid: %.2fx%.2f cells from (%.2f,%.2f), %.0f%%/%.0f%% aligned\n",
+               (double)ex.scale / GRID_ONE, (double)ey.scale / GRID_ONE,
+               (double)ex.phase / GRID_ONE, (double)ey.phase / GRID_ONE,
+               ex.confidence * 100.0, ey.confidence * 100.0);
+    }
+    atomic_store(&content_scale_x, ex.scale);
+    atomic_store(&content_scale_y, ey.scale);
+    // Small phase changes are noise: following them would shift the picture by a pixel now and then
+    if (rescaled || grid_phase_moved(content_phase_x, ex.phase, ex.scale)) content_phase_x = ex.phase;
+    if (rescaled || grid_phase_moved(content_phase_y, ey.phase, ey.scale)) content_phase_y = ey.phase;
+    grid_settled = true;
+}
+
+// Border scan and preset auto-detect - runs on the capture thread
+static void analyze_frame(const frame_view_t *frame) {
+    // Manual border scan (D key), needs the whole frame
+    bool whole_frame = frame->data_w == frame->source_w && frame->data_h == frame->source_h;
+    if (whole_frame && atomic_exchange(&pending_border_scan, false)) {
+        int new_cx, new_cy, new_cw, new_ch;
+        if (scan_for_game_area(frame, &new_cx, &new_cy, &new_cw, &new_ch)) {
+            printf("Detected game area: %dx%d at (%d,%d)\n", new_cw, new_ch, new_cx, new_cy);
+            printf("Native resolution: %dx%d\n", new_cw * GRID_ONE / content_scale_x,
+                   new_ch * GRID_ONE / content_scale_y);
             
-            int uu = u - 128;
-            int vv = v - 128;
-            int ruv = (359 * vv) >> 8;
-            int guv = (88 * uu + 183 * vv) >> 8;
-            int buv = (454 * uu) >> 8;
+            // Apply the detected crop, render thread copies it to config for saving
+            crop_x = new_cx; crop_y = new_cy;
+            crop_w = new_cw; crop_h = new_ch;
+            atomic_store(&pending_crop_saved, true);
+            reset_grid();
             
-            int r0 = y0 + ruv;
-            int g0 = y0 - guv;
-            int b0 = y0 + buv;
-            int r1 = y1 + ruv;
-            int g1 = y1 - guv;
-            int b1 = y1 + buv;
+            // Disable auto-detect when manually scanning
+            auto_detect = false;
+            last_detected = PRESET_NONE;
             
-            out[0] = r0 < 0 ? 0 : (r0 > 255 ? 255 : r0);
-            out[1] = g0 < 0 ? 0 : (g0 > 255 ? 255 : g0);
-            out[2] = b0 < 0 ? 0 : (b0 > 255 ? 255 : b0);
-            out[3] = 255;
-            out[4] = r1 < 0 ? 0 : (r1 > 255 ? 255 : r1);
-            out[5] = g1 < 0 ? 0 : (g1 > 255 ? 255 : g1);
-            out[6] = b1 < 0 ? 0 : (b1 > 255 ? 255 : b1);
-            out[7] = 255;
-            out += 8;
+            printf("Press F1 to save as preset\n");
+        } else {
+            printf("No game border detected\n");
+        }
+    }
+    
+    // Auto-detect preset if enabled (check every 30 frames ~1 sec)
+    // Only re-evaluate if the border area has actually changed
+    static int startup_frames = 0;
+    startup_frames++;
+    
+    if (auto_detect && startup_frames > 5 && detect_cooldown <= 0) {
+        if (border_changed(frame, last_detected)) {
+            detected_preset_t detected = detect_preset(frame);
+            if (detected != (detected_preset_t)last_detected) {
+                int new_cw = crop_w, new_ch = crop_h;
+                apply_detected_preset(detected, &crop_x, &crop_y, &new_cw, &new_ch);
+                
+                if (new_cw != crop_w || new_ch != crop_h) {
+                    crop_w = new_cw; crop_h = new_ch;
+                    reset_grid();
+                    const char *names[] = {"None", "NES", "SNES"};
+                    printf("Auto-detected: %s (%dx%d)\n", names[detected], crop_w, crop_h);
+                }
+                
+                // 16:9 content wants 480i for vertical resolution, NES/SNES 240p for scanlines.
+                // Switching shells out to tvservice, so the render thread does it.
+                atomic_store(&pending_video_mode, detected == PRESET_NONE ? 0 : 1);
+                
+                last_detected = detected;
+            }
         }
+        detect_cooldown = 30;
+    }
+    
+    if (grid_due()) {
+        analyze_grid(frame);
+        grid_cooldown = grid_settled ? GRID_FRAMES : GRID_RETRY_FRAMES;
+    }
+    count_down_detectors();
+}
+
+// Mode negotiation input: the active crop has to keep at least the 2x-native
+// detail the CRT output shows (half the crop for 4x upscaled content)
+static capture_request_t capture_request(void) {
+    capture_request_t request = {
+        .width = REF_W, .height = REF_H,
+        .crop_w = crop_w, .crop_h = crop_h,
+        .min_crop_w = crop_w * 2 * GRID_ONE / atomic_load(&content_scale_x),
+        .min_crop_h = crop_h * 2 * GRID_ONE / atomic_load(&content_scale_y),
+        .fps = 60,
+        .userptr = use_userptr,
+    };
+    return request;
+}
+
+// Close the capture device and open it again with the current request, keeping the
+// frame counters. Decode workers must have given their frames back. False = capture
+// is NULL, call again to retry.
+static bool reopen_capture(void) {
+    static capture_stats_t totals;
+    if (capture) totals = capture->stats;
+    capture_close(capture);
+    capture_request_t request = capture_request();
+    capture = capture_open_request(capture_device, &request, buffer_count);
+    if (!capture) return false;
+    capture->wake_fd = wake_fd;
+    capture->stats = totals;
+    return true;
+}
+
+// Re-pick the capture mode when the crop or the content scale changed what it has
+// to resolve. True when the device switched modes.
+static bool update_capture_mode(void) {
+    capture_request_t request = capture_request();
+    const capture_request_t *current = &capture->request;
+    if (request.crop_w == current->crop_w && request.crop_h == current->crop_h &&
+        request.min_crop_w == current->min_crop_w && request.min_crop_h == current->min_crop_h) {
+        return false;
+    }
+    if (decode_threads > 0) decode_pool_drain(&decode_pool);
+    return capture_set_request(capture, &request);
+}
+
+// Pick what the device should deliver: the crop, grown to cover the auto-detect
+// probes while auto-detect runs, or everything for a border scan. The capture
+// thread crops the rest in software.
+static void update_device_crop(uint64_t *applied) {
+    int x = crop_x, y = crop_y, w = crop_w, h = crop_h;
+    if (pending_border_scan) {
+        x = 0; y = 0; w = REF_W; h = REF_H;
+    } else if (auto_detect) {
+        int right = x + w > DETECT_AREA_X + DETECT_AREA_W ? x + w : DETECT_AREA_X + DETECT_AREA_W;
+        int bottom = y + h > DETECT_AREA_Y + DETECT_AREA_H ? y + h : DETECT_AREA_Y + DETECT_AREA_H;
+        if (x > DETECT_AREA_X) x = DETECT_AREA_X;
+        if (y > DETECT_AREA_Y) y = DETECT_AREA_Y;
+        w = right - x;
+        h = bottom - y;
+    }
+    
+    uint64_t wanted = pack_crop(x, y, w, h);
+    if (wanted == *applied) return;
+    *applied = wanted;
+    if (decode_threads > 0) decode_pool_drain(&decode_pool);
+    
+    if (w >= REF_W && h >= REF_H) {
+        capture_set_crop(capture, 0, 0, 0, 0);
+        return;
     }
+    // Mode pixels, even x/width for YUYV pairs, rounded outwards
+    int sx = (x * capture->source_width / REF_W) & ~1;
+    int sy = y * capture->source_height / REF_H;
+    int sw = (((x + w) * capture->source_width + REF_W - 1) / REF_W - sx + 1) & ~1;
+    int sh = ((y + h) * capture->source_height + REF_H - 1) / REF_H - sy;
+    if (sx + sw > capture->source_width) sw = capture->source_width - sx;
+    if (sy + sh > capture->source_height) sh = capture->source_height - sy;
+    capture_set_crop(capture, sx, sy, sw, sh);
+}
+
+// Wake the render thread, unless it already has an announcement queued
+static void announce_frame(void) {
+    if (!atomic_exchange(&frame_event_pending, true)) {
+        SDL_Event event = {0};
+        event.type = frame_event_type;
+        SDL_PushEvent(&event);
+    }
+}
+
+// Make the capture thread's frame counters visible to the render thread
+static void publish_capture_stats(void) {
+    atomic_store(&frames_dequeued, capture->stats.dequeued);
+    atomic_store(&frames_dropped, capture->stats.dropped);
+    atomic_store(&frames_errored, capture->stats.errors);
+    atomic_store(&frames_repeated, capture->stats.repeated);
+}
+
+// Capture thread: dequeue, analyze, convert the crop and publish it to the render thread
+static int capture_thread_main(void *data) {
+    (void)data;
+    uint64_t device_crop = pack_crop(0, 0, REF_W, REF_H);  // What the device delivers, see pack_crop()
+    uint64_t shown_fingerprint = 0;  // Payload and crop of the last frame sent for display
+    uint64_t shown_crop = 0;
+    if (decode_threads > 0 && !decode_pool_init(&decode_pool, decode_threads, &mailbox, announce_frame)) {
+        fprintf(stderr, "Decode pool unavailable, converting on the capture thread\n");
+        decode_threads = 0;
+    }
+    if (convert_threads != 1 && !capture_set_convert_threads(convert_threads)) {
+        fprintf(stderr, "Conversion threads unavailable, converting each frame on one thread\n");
+    }
+    
+    while (running) {
+        // New buffer count: rebuild the queue in place, reopen only if that fails.
+        // Workers give their frames back first, buffers must not change under them.
+        bool buffer_change = atomic_exchange(&pending_buffer_change, false);
+        if (buffer_change && decode_threads > 0) decode_pool_drain(&decode_pool);
+        if (buffer_change && !capture_set_buffer_count(capture, buffer_count)) {
+            if (!reopen_capture()) {
+                fprintf(stderr, "Failed to reinit capture with %d buffers\n", (int)buffer_count);
+                running = false;
+                break;
+            }
+            device_crop = pack_crop(0, 0, REF_W, REF_H);
+            printf("Capture reinit: %d buffers\n", capture->buffer_count);
+        }
+        if (auto_buffers && capture_tune_buffers(capture, 2, 4)) {
+            buffer_count = capture->buffer_count;
+        } else if (capture->buffer_count == 0) {
+            atomic_store(&pending_buffer_change, true);
+        }
+        
+        if (atomic_exchange(&pending_refresh, false)) shown_fingerprint = 0;
+        uint64_t crop_request = atomic_exchange(&pending_crop, 0);
+        if (crop_request & CROP_REQUEST_VALID) {
+            unpack_crop(crop_request, &crop_x, &crop_y, &crop_w, &crop_h);
+        }
+        if (update_capture_mode()) {
+            device_crop = pack_crop(0, 0, REF_W, REF_H);
+            shown_fingerprint = 0;
+        }
+        if (capture->can_crop) update_device_crop(&device_crop);
+        
+        // Sleep until the driver has a frame (or the UI wakes us)
+        capture_wait_t waited = capture_wait_frame(capture, CAPTURE_WAIT_MS);
+        if (waited == CAPTURE_WAIT_SOURCE_CHANGE) {
+            // New input mode: renegotiate in place, the render thread follows the frame size.
+            // If that left the device without buffers, fall back to reopening it.
+            printf("Capture: input changed\n");
+            if (decode_threads > 0) decode_pool_drain(&decode_pool);
+            if (!capture_renegotiate(capture) && capture->buffer_count == 0) {
+                atomic_store(&pending_buffer_change, true);
+            }
+            device_crop = pack_crop(0, 0, REF_W, REF_H);
+            shown_fingerprint = 0;
+            reset_grid();
+            continue;
+        }
+        if (waited == CAPTURE_WAIT_ERROR) {
+            // Device failed (e.g. unplugged): reopen it, retrying until it is back
+            printf("Capture: device error, reopening\n");
+            if (decode_threads > 0) decode_pool_drain(&decode_pool);
+            while (!reopen_capture() && running) usleep(CAPTURE_REOPEN_MS * 1000);
+            if (!capture) break;
+            device_crop = pack_crop(0, 0, REF_W, REF_H);
+            shown_fingerprint = 0;
+            reset_grid();
+            continue;
+        }
+        if (waited != CAPTURE_WAIT_FRAME) continue;
+        
+        // Get raw frame (YUYV or MJPEG)
+        capture_frame_t *captured;
+        if (latest_only) {
+            int skipped;
+            captured = capture_acquire_latest(capture, &skipped);
+            if (skipped) atomic_fetch_add(&stale_skipped, skipped);
+        } else {
+            captured = capture_acquire(capture);
+        }
+        if (!captured) continue;
+        publish_capture_stats();
+        
+        // Corrupt data would flash on screen, keep showing the previous frame
+        if (captured->error) {
+            capture_frame_release(captured);
+            continue;
+        }
+        
+        // Same compressed payload as the frame on screen (static screens, 30 fps games):
+        // skip decode, conversion and upload, unless the detectors want pixels
+        uint64_t fingerprint = capture_frame_fingerprint(captured);
+        uint64_t target_crop = pack_crop(crop_x, crop_y, crop_w, crop_h);
+        if (fingerprint && fingerprint == shown_fingerprint && target_crop == shown_crop && !detectors_due()) {
+            count_down_detectors();
+            atomic_fetch_add(&frames_duplicate, 1);
+            capture_frame_release(captured);
+            continue;
+        }
+        
+        frame_view_t frame = {
+            captured->data, REF_W, REF_H, capture->source_width, capture->source_height,
+            capture->crop_left, capture->crop_top, captured->width, captured->height, false
+        };
+        if (captured->format != V4L2_PIX_FMT_YUYV && detectors_due()) {
+            // Detectors need pixels, decode compressed frames whole when they run
+            frame.data = capture_decode_frame(capture, captured->data, captured->size);
+            frame.rgba = true;
+        }
+        
+        // Between detections compressed frames skip this and only their crop is decoded
+        if (frame.rgba || captured->format == V4L2_PIX_FMT_YUYV) {
+            analyze_frame(&frame);
+        } else {
+            count_down_detectors();
+        }
+        
+        // Crop in the pixels of the delivered frame, even x/width for YUYV pairs
+        int sx = ((crop_x * capture->source_width / REF_W) & ~1) - capture->crop_left;
+        int sy = crop_y * capture->source_height / REF_H - capture->crop_top;
+        int sw = (crop_w * capture->source_width / REF_W) & ~1;
+        int sh = crop_h * capture->source_height / REF_H;
+        
+        if (sx < 0 || sy < 0 || sx + sw > captured->width || sy + sh > captured->height) {
+            static bool warned = false;
+            if (!warned) {
+                fprintf(stderr, "Crop %dx%d at (%d,%d) exceeds %dx%d frame, not converting\n",
+                        sw, sh, sx, sy, captured->width, captured->height);
+                warned = true;
+            }
+            capture_frame_release(captured);
+            continue;
+        }
+        
+        // Upscale in delivered pixels: retro crops can be decoded at native size
+        // (the renderer scales by shown crop, not texture size), 16:9 content is shown as is.
+        // Only whole, square cells in the delivered mode qualify.
+        int upscale = 1;
+        if (crop_w != REF_W || crop_h != REF_H) {
+            int ux = content_scale_x * capture->source_width, uy = content_scale_y * capture->source_height;
+            int units_x = REF_W * GRID_ONE, units_y = REF_H * GRID_ONE;
+            if (ux % units_x == 0 && uy % units_y == 0 && ux / units_x == uy / units_y) upscale = ux / units_x;
+        }
+        
+        // Start on a cell of the pixel grid, so native samples land in cell middles
+        // and not on the blurred edges between cells: the converted area moves by
+        // less than a cell, keeping its size unless that runs off the frame
+        if (upscale > 1) {
+            int phase_x = (content_phase_x * capture->source_width + REF_W * GRID_ONE / 2) / (REF_W * GRID_ONE);
+            int phase_y = (content_phase_y * capture->source_height + REF_H * GRID_ONE / 2) / (REF_H * GRID_ONE);
+            int shift_x = ((phase_x - sx - capture->crop_left) % upscale + upscale) % upscale;
+            int shift_y = ((phase_y - sy - capture->crop_top) % upscale + upscale) % upscale;
+            sx += shift_x;
+            sy += shift_y;
+            if (sx + sw > captured->width) sw -= upscale;
+            if (sy + sh > captured->height) sh -= upscale;
+        }
+        
+        shown_fingerprint = fingerprint;
+        shown_crop = pack_crop(crop_x, crop_y, crop_w, crop_h);
+        
+        // Hand the frame to a worker and go back to the driver. Workers decode from the
+        // raw data with their own decoder, in-order mode waits instead of replacing frames.
+        if (decode_threads > 0) {
+            decode_job_t job = {
+                captured, sx, sy, sw, sh, upscale, planar_output, crop_x, crop_y, crop_w, crop_h, 0
+            };
+            decode_pool_submit(&decode_pool, &job, !latest_only);
+            continue;
+        }
+        
+        mailbox_slot_t *slot = mailbox_write_slot(&mailbox);
+        if (!mailbox_slot_reserve(slot, sw * sh * 4)) {
+            shown_fingerprint = 0;
+            capture_frame_release(captured);
+            continue;
+        }
+        
+        // Convert only the cropped region. Detector frames are decoded whole already,
+        // but decoding the crop at native size again keeps the texture size steady.
+        int scale = 0;
+        if (planar_output) {
+            scale = capture_convert_crop_iyuv(capture, captured->data, captured->size, slot->pixels,
+                                              sx, sy, sw, sh, upscale);
+        }
+        slot->planar = scale > 0;
+        if (slot->planar) {
+            // Planes are done, RGBA only for frames that cannot be delivered as I420
+        } else if (frame.rgba && upscale == 1) {
+            scale = 1;
+            for (int y = 0; y < sh; y++) {
+                memcpy(slot->pixels + y * sw * 4,
+                       frame.data + ((sy + y) * frame.data_w + sx) * 4, sw * 4);
+            }
+        } else {
+            scale = capture_convert_crop_native(capture, captured->data, captured->size, slot->pixels,
+                                                sx, sy, sw, sh, upscale);
+        }
+        slot->capture_ns = captured->timestamp_ns;
+        slot->ts_flags = captured->ts_flags;
+        capture_frame_release(captured);
+        
+        slot->width = sw / scale;
+        slot->height = sh / scale;
+        if (slot->planar) {
+            slot->width &= ~1;
+            slot->height &= ~1;
+        }
+        slot->crop_x = crop_x;
+        slot->crop_y = crop_y;
+        slot->crop_w = crop_w;
+        slot->crop_h = crop_h;
+        mailbox_publish(&mailbox);
+        announce_frame();
+    }
+    
+    if (decode_threads > 0) decode_pool_destroy(&decode_pool);
+    capture_set_convert_threads(1);
+    return 0;
+}
+
+// Texture for the cropped region only (much smaller than the full frame!)
+// Planar frames go to an IYUV texture, the renderer converts them to RGB on the GPU
+static SDL_Texture *create_frame_texture(SDL_Renderer *renderer, int w, int h, bool planar) {
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
+    return SDL_CreateTexture(renderer, planar ? SDL_PIXELFORMAT_IYUV : SDL_PIXELFORMAT_RGBA32,
+        SDL_TEXTUREACCESS_STREAMING, w, h);
 }
 
 void draw_text(SDL_Renderer *renderer, int x, int y, const char *text, SDL_Color color) {
@@ -470,9 +1009,10 @@ void draw_osd(SDL_Renderer *renderer, int width, int height) {
         current_fps = frame_count * 1000.0f / (now - last_fps_time);
         frame_count = 0;
         last_fps_time = now;
+        latency_summarize(&latency, &latency_summary);
     }
     
-    char info[128];
+    char info[256];
     const char *auto_str = auto_detect ? "AUTO" : "Manual";
     const char *preset_str = "";
     if (auto_detect) {
@@ -482,40 +1022,63 @@ void draw_osd(SDL_Renderer *renderer, int width, int height) {
             default: preset_str = "[None]"; break;
         }
     }
-    snprintf(info, sizeof(info), "%.1ffps %s%s %s %s %s B%d | A=Auto S V C B", 
+    uint64_t dequeued = frames_dequeued;
+    uint64_t handled = frames_presented + frames_duplicate;
+    uint64_t unpresented = dequeued > handled ? dequeued - handled : 0;
+    snprintf(info, sizeof(info), "%.1ffps %s%s %s %s %s B%d%s%s lat %.1f/%.1f/%.1fms drop %llu err %llu miss %llu dup %llu | A=Auto S V C B N", 
              current_fps,
              auto_str, preset_str,
              scale_mode == SCALE_PIXEL ? "Px" : "Sm",
              config.use_240p ? "240p" : "480i",
              color_mode == COLOR_PAL60 ? "PAL60" : "NTSC",
-             buffer_count);
+             (int)buffer_count, auto_buffers ? "a" : "", latest_only ? "N" : "",
+             latency_summary.min_ms, latency_summary.avg_ms, latency_summary.p99_ms,
+             (unsigned long long)frames_dropped, (unsigned long long)frames_errored,
+             (unsigned long long)unpresented, (unsigned long long)frames_duplicate);
     draw_text(renderer, 10, height - 18, info, white);
 }
 
 int main(int argc, char *argv[]) {
-    const char *device = "/dev/video0";
     bool fullscreen = true;
     
     static struct option long_opts[] = {
         {"device", required_argument, 0, 'd'},
         {"pixel", no_argument, 0, 'x'},
         {"windowed", no_argument, 0, 'w'},
+        {"in-order", no_argument, 0, 'i'},
+        {"userptr", no_argument, 0, 'u'},
+        {"decode-threads", required_argument, 0, 'j'},
+        {"yuv", no_argument, 0, 'y'},
+        {"convert-threads", required_argument, 0, 't'},
+        {"average", no_argument, 0, 'a'},
         {"help", no_argument, 0, 'h'},
         {0, 0, 0, 0}
     };
     
     int opt;
-    while ((opt = getopt_long(argc, argv, "d:xwh", long_opts, NULL)) != -1) {
+    while ((opt = getopt_long(argc, argv, "d:xwiuj:yt:ah", long_opts, NULL)) != -1) {
         switch (opt) {
-            case 'd': device = optarg; break;
+            case 'd': capture_device = optarg; break;
             case 'x': scale_mode = SCALE_PIXEL; break;
             case 'w': fullscreen = false; break;
+            case 'i': latest_only = false; break;
+            case 'u': use_userptr = true; break;
+            case 'j': decode_threads = atoi(optarg); break;
+            case 'y': planar_output = true; break;
+            case 't': convert_threads = atoi(optarg); break;
+            case 'a': native_average = true; break;
             case 'h': 
             default:
                 printf("Usage: %s [options]\n", argv[0]);
-                printf("  -d, --device PATH   Capture device\n");
+                printf("  -d, --device PATH   Capture device, synth[:yuyv|mjpeg][@FPS] or replay:FILE[@FPS]\n");
                 printf("  -x, --pixel         Pixel-perfect mode\n");
                 printf("  -w, --windowed      Windowed mode\n");
+                printf("  -i, --in-order      Show every queued frame instead of only the newest\n");
+                printf("  -u, --userptr       Capture into a cacheable huge-page pool (V4L2_MEMORY_USERPTR)\n");
+                printf("  -j, --decode-threads N  Convert frames on N worker threads (default 2, 0 = off)\n");
+                printf("  -y, --yuv           Upload frames as planar YUV, colour conversion on the GPU\n");
+                printf("  -t, --convert-threads N  Split each YUYV conversion over N threads (default 0 = one per core)\n");
+                printf("  -a, --average       Average each upscaled cell for native pixels (M toggles)\n");
                 printf("\nControls: S=Scale, V=Video, O=OSD, F=Fullscreen, Q=Quit\n");
                 return opt == 'h' ? 0 : 1;
         }
@@ -532,6 +1095,9 @@ int main(int argc, char *argv[]) {
         fprintf(stderr, "SDL_Init: %s\n", SDL_GetError());
         return 1;
     }
+    // MJPEG planes are full-range BT.601, the same maths as the CPU conversion
+    if (planar_output) SDL_SetYUVConversionMode(SDL_YUV_CONVERSION_JPEG);
+    capture_set_native_average(native_average);
     
     if (TTF_Init() < 0) {
         fprintf(stderr, "TTF_Init: %s\n", TTF_GetError());
@@ -566,9 +1132,10 @@ int main(int argc, char *argv[]) {
     if (!renderer) renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_SOFTWARE);
     
     // Open capture
-    capture = capture_open(device, 1920, 1080);
+    capture_request_t request = capture_request();
+    capture = capture_open_request(capture_device, &request, buffer_count);
     if (!capture) {
-        fprintf(stderr, "Failed to open %s\n", device);
+        fprintf(stderr, "Failed to open %s\n", capture_device);
         SDL_DestroyRenderer(renderer); SDL_DestroyWindow(window);
         TTF_Quit(); SDL_Quit();
         return 1;
@@ -576,21 +1143,38 @@ int main(int argc, char *argv[]) {
     
     printf("Capture: %dx%d, Crop: %dx%d\n", capture->width, capture->height, crop_w, crop_h);
     
-    // Create texture for cropped region only (much smaller!)
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
-    SDL_Texture *texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-        SDL_TEXTUREACCESS_STREAMING, crop_w, crop_h);
+    SDL_Texture *texture = create_frame_texture(renderer, crop_w, crop_h, false);
+    int tex_w = crop_w, tex_h = crop_h;
+    bool tex_planar = false;
     
-    // Buffer for cropped RGBA
-    uint8_t *crop_buffer = malloc(crop_w * crop_h * 4);
+    // Capture and conversion run on their own thread, frames arrive through the mailbox
+    mailbox_init(&mailbox);
+    frame_event_type = SDL_RegisterEvents(1);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    capture->wake_fd = wake_fd;
+    SDL_Thread *capture_thread = SDL_CreateThread(capture_thread_main, "capture", NULL);
+    if (!capture_thread) {
+        fprintf(stderr, "SDL_CreateThread: %s\n", SDL_GetError());
+        running = false;
+    }
     
     if (fullscreen) SDL_ShowCursor(SDL_DISABLE);
     
-    printf("Controls: S=Scale, V=Video, C=Color, O=OSD, F1=Save, F2=Load, Q=Quit\n");
+    printf("Controls: S=Scale, V=Video, C=Color, B=Buffers, N=Newest, M=Mean, O=OSD, F1=Save, F2=Load, Q=Quit\n");
+    
+    latency_init(&latency);
+    Uint32 last_stats_log = SDL_GetTicks();
+    uint32_t slot_ts_flags = 0;
     
     SDL_Event event;
     while (running) {
-        while (SDL_PollEvent(&event)) {
+        // Sleep until a UI event or a frame announcement arrives, then drain the queue
+        for (int got = SDL_WaitEventTimeout(&event, RENDER_IDLE_MS); got; got = SDL_PollEvent(&event)) {
+            if (event.type == frame_event_type) {
+                atomic_store(&frame_event_pending, false);
+                continue;
+            }
+            
             if (event.type == SDL_QUIT) running = false;
             
             // Text input for save preset dialog
@@ -620,10 +1204,10 @@ int main(int argc, char *argv[]) {
                             break;
                         case SDLK_RETURN:
                             if (preset_input_len > 0) {
-                                config.crop_x = crop_x;
-                                config.crop_y = crop_y;
-                                config.crop_w = crop_w;
-                                config.crop_h = crop_h;
+                                config.crop_x = shown_crop.x;
+                                config.crop_y = shown_crop.y;
+                                config.crop_w = shown_crop.w;
+                                config.crop_h = shown_crop.h;
                                 config_save_preset(&config, preset_input);
                                 printf("Saved preset: %s\n", preset_input);
                             }
@@ -664,18 +1248,12 @@ int main(int argc, char *argv[]) {
                                     name = preset_names[preset_selected - 2];
                                 }
                                 if (name && config_load_preset(&config, name)) {
-                                    crop_x = config.crop_x;
-                                    crop_y = config.crop_y;
-                                    crop_w = config.crop_w;
-                                    crop_h = config.crop_h;
-                                    // Recreate texture for new size
-                                    SDL_DestroyTexture(texture);
-                                    free(crop_buffer);
-                                    crop_buffer = malloc(crop_w * crop_h * 4);
-                                    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
-                                    texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                                        SDL_TEXTUREACCESS_STREAMING, crop_w, crop_h);
-                                    printf("Loaded preset: %s (%dx%d at %d,%d)\n", name, crop_w, crop_h, crop_x, crop_y);
+                                    // Capture thread switches crop, texture follows the next frame
+                                    atomic_store(&pending_crop, pack_crop(config.crop_x, config.crop_y,
+                                                                          config.crop_w, config.crop_h));
+                                    wake_capture_thread();
+                                    printf("Loaded preset: %s (%dx%d at %d,%d)\n", name,
+                                           config.crop_w, config.crop_h, config.crop_x, config.crop_y);
                                 }
                             }
                             ui_mode = UI_NORMAL;
@@ -695,9 +1273,9 @@ int main(int argc, char *argv[]) {
                     case SDLK_s:
                         scale_mode = (scale_mode == SCALE_SMOOTH) ? SCALE_PIXEL : SCALE_SMOOTH;
                         SDL_DestroyTexture(texture);
-                        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
-                        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                            SDL_TEXTUREACCESS_STREAMING, crop_w, crop_h);
+                        texture = create_frame_texture(renderer, tex_w, tex_h, tex_planar);
+                        atomic_store(&pending_refresh, true);
+                        wake_capture_thread();
                         printf("Scale: %s\n", scale_mode == SCALE_PIXEL ? "pixel" : "smooth");
                         break;
                         
@@ -722,15 +1300,38 @@ int main(int argc, char *argv[]) {
                     case SDLK_d:
                         // Detect border and apply as current crop
                         pending_border_scan = true;
+                        wake_capture_thread();
                         printf("Scanning for game border...\n");
                         break;
                     
                     case SDLK_b:
-                        // Cycle buffer count 1-4
-                        buffer_count++;
-                        if (buffer_count > 4) buffer_count = 1;
+                        // Cycle buffer count 1-4, then auto-tuned starting from 2
+                        if (auto_buffers) {
+                            auto_buffers = false;
+                            buffer_count = 1;
+                        } else if (buffer_count >= 4) {
+                            auto_buffers = true;
+                            buffer_count = 2;
+                        } else {
+                            buffer_count++;
+                        }
                         pending_buffer_change = true;
-                        printf("Buffer count: %d (will reinit capture)\n", buffer_count);
+                        wake_capture_thread();
+                        printf("Buffer count: %s%d\n", auto_buffers ? "auto from " : "", (int)buffer_count);
+                        break;
+                        
+                    case SDLK_m:
+                        // Native YUYV pixels: cell mean (clean on noisy cards) or middle sample
+                        native_average = !native_average;
+                        capture_set_native_average(native_average);
+                        printf("Native pixels: %s\n", native_average ? "cell mean" : "cell middle");
+                        break;
+                        
+                    case SDLK_n:
+                        // Newest-frame mode: drain stale buffers instead of showing them in order
+                        latest_only = !latest_only;
+                        printf("Latest-frame drain: %s (%llu stale frames skipped so far)\n",
+                               latest_only ? "ON" : "OFF", (unsigned long long)stale_skipped);
                         break;
                         
                     case SDLK_o:
@@ -765,123 +1366,44 @@ int main(int argc, char *argv[]) {
             }
         }
         
-        // Reinit capture if buffer count changed
-        if (pending_buffer_change) {
-            pending_buffer_change = false;
-            capture_close(capture);
-            capture = capture_open_buffers(device, 1920, 1080, buffer_count);
-            if (!capture) {
-                fprintf(stderr, "Failed to reinit capture with %d buffers\n", buffer_count);
-                running = false;
-                continue;
+        // Pick up the newest converted frame, if the capture thread published one
+        uint64_t new_frame_ns = 0;
+        mailbox_slot_t *slot = mailbox_take(&mailbox);
+        if (slot) {
+            new_frame_ns = slot->capture_ns;
+            slot_ts_flags = slot->ts_flags;
+            if (!texture || slot->width != tex_w || slot->height != tex_h || slot->planar != tex_planar) {
+                SDL_DestroyTexture(texture);
+                tex_w = slot->width;
+                tex_h = slot->height;
+                tex_planar = slot->planar;
+                texture = create_frame_texture(renderer, tex_w, tex_h, tex_planar);
             }
-            printf("Capture reinit: %d buffers\n", capture->buffer_count);
-        }
-        
-        // Get raw YUYV frame
-        size_t raw_size;
-        uint8_t *raw = capture_get_frame_raw(capture, &raw_size);
-        if (raw) {
-            // Manual border scan (D key)
-            if (pending_border_scan) {
-                pending_border_scan = false;
-                int new_cx, new_cy, new_cw, new_ch;
-                if (scan_for_game_area(raw, capture->width, capture->height,
-                                       &new_cx, &new_cy, &new_cw, &new_ch)) {
-                    printf("Detected game area: %dx%d at (%d,%d)\n", new_cw, new_ch, new_cx, new_cy);
-                    printf("Native resolution: %dx%d\n", new_cw / 4, new_ch / 4);
-                    
-                    // Apply the detected crop
-                    if (new_cw != crop_w || new_ch != crop_h) {
-                        crop_x = new_cx; crop_y = new_cy;
-                        crop_w = new_cw; crop_h = new_ch;
-                        
-                        SDL_DestroyTexture(texture);
-                        free(crop_buffer);
-                        crop_buffer = malloc(crop_w * crop_h * 4);
-                        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
-                        texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                            SDL_TEXTUREACCESS_STREAMING, crop_w, crop_h);
-                    } else {
-                        crop_x = new_cx; crop_y = new_cy;
-                    }
-                    
-                    // Update config for saving
-                    config.crop_x = crop_x;
-                    config.crop_y = crop_y;
-                    config.crop_w = crop_w;
-                    config.crop_h = crop_h;
-                    
-                    // Disable auto-detect when manually scanning
-                    auto_detect = false;
-                    last_detected = PRESET_NONE;
-                    
-                    printf("Press F1 to save as preset\n");
-                } else {
-                    printf("No game border detected\n");
-                }
+            if (slot->planar) {
+                const uint8_t *u = slot->pixels + tex_w * tex_h;
+                const uint8_t *v = u + (tex_w / 2) * (tex_h / 2);
+                SDL_UpdateYUVTexture(texture, NULL, slot->pixels, tex_w, u, tex_w / 2, v, tex_w / 2);
+            } else {
+                SDL_UpdateTexture(texture, NULL, slot->pixels, slot->width * 4);
             }
+            shown_crop = (SDL_Rect){slot->crop_x, slot->crop_y, slot->crop_w, slot->crop_h};
             
-            // Auto-detect preset if enabled (check every 30 frames ~1 sec)
-            // Only re-evaluate if the border area has actually changed
-            static int startup_frames = 0;
-            startup_frames++;
-            
-            if (auto_detect && startup_frames > 5 && detect_cooldown <= 0) {
-                if (border_changed(raw, capture->width, last_detected)) {
-                    detected_preset_t detected = detect_preset(raw, capture->width, capture->height);
-                    if (detected != last_detected) {
-                        int new_cx, new_cy, new_cw, new_ch;
-                        apply_detected_preset(detected, &new_cx, &new_cy, &new_cw, &new_ch);
-                        
-                        // Only reallocate if size changed
-                        if (new_cw != crop_w || new_ch != crop_h) {
-                            crop_x = new_cx; crop_y = new_cy;
-                            crop_w = new_cw; crop_h = new_ch;
-                            
-                            SDL_DestroyTexture(texture);
-                            free(crop_buffer);
-                            crop_buffer = malloc(crop_w * crop_h * 4);
-                            SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, scale_mode == SCALE_PIXEL ? "0" : "1");
-                            texture = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_RGBA32,
-                                SDL_TEXTUREACCESS_STREAMING, crop_w, crop_h);
-                            
-                            const char *names[] = {"None", "NES", "SNES"};
-                            printf("Auto-detected: %s (%dx%d)\n", names[detected], crop_w, crop_h);
-                        } else {
-                            crop_x = new_cx; crop_y = new_cy;
-                        }
-                        
-                        // Switch video mode based on preset
-                        if (detected == PRESET_NONE) {
-                            // 16:9 content - use 480i for more vertical resolution
-                            if (config.use_240p) {
-                                config.use_240p = false;
-                                set_video_mode(false);
-                                printf("Switched to 480i for 16:9 content\n");
-                            }
-                        } else {
-                            // NES/SNES - use 240p for scanlines
-                            if (!config.use_240p) {
-                                config.use_240p = true;
-                                set_video_mode(true);
-                                printf("Switched to 240p for retro content\n");
-                            }
-                        }
-                        
-                        last_detected = detected;
-                    }
-                }
-                detect_cooldown = 30;
+            // Update config for saving
+            if (atomic_exchange(&pending_crop_saved, false)) {
+                config.crop_x = shown_crop.x;
+                config.crop_y = shown_crop.y;
+                config.crop_w = shown_crop.w;
+                config.crop_h = shown_crop.h;
             }
-            if (detect_cooldown > 0) detect_cooldown--;
-            
-            // Convert only the cropped region
-            yuyv_crop_to_rgba(raw, capture->width, capture->height,
-                              crop_buffer, crop_x, crop_y, crop_w, crop_h);
-            capture_return_buffer(capture);
-            
-            SDL_UpdateTexture(texture, NULL, crop_buffer, crop_w * 4);
+        }
+        
+        // Switch video mode based on auto-detected preset
+        int video_mode = atomic_exchange(&pending_video_mode, -1);
+        if (video_mode >= 0 && video_mode != config.use_240p) {
+            config.use_240p = video_mode;
+            set_video_mode(config.use_240p);
+            printf(config.use_240p ? "Switched to 240p for retro content\n"
+                                   : "Switched to 480i for 16:9 content\n");
         }
         
         // Render
@@ -899,14 +1421,15 @@ int main(int argc, char *argv[]) {
         }
         
         // Calculate output size - integer vertical scaling for scanline alignment
-        // Native size = crop size / 4 (since capture is 4x scaled)
-        int native_w = crop_w / 4;
-        int native_h = crop_h / 4;
+        // Native size = crop size / cell size of the detected pixel grid, in 1080p
+        // pixels whatever mode the card was negotiated to
+        int native_w = shown_crop.w * GRID_ONE / atomic_load(&content_scale_x);
+        int native_h = shown_crop.h * GRID_ONE / atomic_load(&content_scale_y);
         
         int dst_w, dst_h;
         
         // Check if this is 16:9 content (full 1920x1080 or close)
-        bool is_16_9 = (crop_w == 1920 && crop_h == 1080);
+        bool is_16_9 = (shown_crop.w == REF_W && shown_crop.h == REF_H);
         
         if (is_16_9) {
             // 16:9 content: letterbox to fit in 4:3 output
@@ -935,16 +1458,52 @@ int main(int argc, char *argv[]) {
         int dst_y = (out_h - dst_h) / 2;
         
         SDL_Rect dst = {dst_x, dst_y, dst_w, dst_h};
-        SDL_RenderCopy(renderer, texture, NULL, &dst);
+        if (texture) SDL_RenderCopy(renderer, texture, NULL, &dst);
         
         if (show_osd) draw_osd(renderer, out_w, out_h);
         
         SDL_RenderPresent(renderer);
+        
+        // Capture-to-present latency, once per new frame. With vsync the
+        // present returns after the flip, so this includes the wait for it.
+        if (slot) frames_presented++;
+        if (new_frame_ns) {
+            uint64_t now_ns = capture_now_ns();
+            if (now_ns > new_frame_ns) latency_add(&latency, now_ns - new_frame_ns);
+        }
+        
+        Uint32 now_ms = SDL_GetTicks();
+        if (now_ms - last_stats_log >= STATS_LOG_MS) {
+            latency_summary_t s;
+            latency_summarize(&latency, &s);
+            if (s.count > 0) {
+                printf("Latency: min %.1f avg %.1f p99 %.1f max %.1f ms over %d frames%s\n",
+                       s.min_ms, s.avg_ms, s.p99_ms, s.max_ms, s.count,
+                       (slot_ts_flags & CAPTURE_TS_DRIVER) ? "" : " (dequeue time, no driver timestamps)");
+            }
+            
+            // Where frames go missing: before us (dropped), in the queue (stale) or between threads
+            uint64_t dequeued = frames_dequeued;
+            printf("Frames: %llu dequeued, %llu presented, %llu dropped by source, %llu repeated, "
+                   "%llu duplicate, %llu errors, %llu stale, %llu replaced, %llu superseded, %llu overwritten\n",
+                   (unsigned long long)dequeued, (unsigned long long)frames_presented,
+                   (unsigned long long)frames_dropped, (unsigned long long)frames_repeated,
+                   (unsigned long long)frames_duplicate, (unsigned long long)frames_errored,
+                   (unsigned long long)stale_skipped,
+                   (unsigned long long)atomic_load(&decode_pool.replaced),
+                   (unsigned long long)atomic_load(&decode_pool.superseded),
+                   (unsigned long long)atomic_load(&mailbox.overwritten));
+            last_stats_log = now_ms;
+        }
     }
     
     // Cleanup
-    free(crop_buffer);
+    running = false;
+    wake_capture_thread();
+    if (capture_thread) SDL_WaitThread(capture_thread, NULL);
     capture_close(capture);
+    mailbox_destroy(&mailbox);
+    if (wake_fd >= 0) close(wake_fd);
     SDL_DestroyTexture(texture);
     if (font) TTF_CloseFont(font);
     SDL_DestroyRenderer(renderer);
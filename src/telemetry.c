@@ -0,0 +1,44 @@
+/*
+ * telemetry.c - Capture-to-present latency statistics
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "telemetry.h"
+
+void latency_init(latency_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+}
+
+void latency_add(latency_stats_t *stats, uint64_t latency_ns) {
+    uint64_t us = latency_ns / 1000;
+    stats->samples_us[stats->next] = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+    stats->next = (stats->next + 1) % LATENCY_WINDOW;
+    if (stats->count < LATENCY_WINDOW) stats->count++;
+}
+
+static int compare_u32(const void *a, const void *b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return (x > y) - (x < y);
+}
+
+void latency_summarize(const latency_stats_t *stats, latency_summary_t *out) {
+    memset(out, 0, sizeof(*out));
+    out->count = stats->count;
+    if (stats->count == 0) return;
+    
+    // Sorting a copy is cheap at this window size and called about once a second
+    uint32_t sorted[LATENCY_WINDOW];
+    memcpy(sorted, stats->samples_us, stats->count * sizeof(uint32_t));
+    qsort(sorted, stats->count, sizeof(uint32_t), compare_u32);
+    
+    uint64_t sum = 0;
+    for (int i = 0; i < stats->count; i++) sum += sorted[i];
+    
+    int p99 = (stats->count * 99 + 99) / 100 - 1;
+    out->min_ms = sorted[0] / 1000.0f;
+    out->avg_ms = (float)sum / stats->count / 1000.0f;
+    out->p99_ms = sorted[p99] / 1000.0f;
+    out->max_ms = sorted[stats->count - 1] / 1000.0f;
+}
@@ -0,0 +1,30 @@
+/*
+ * telemetry.h - Capture-to-present latency statistics
+ */
+
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stdint.h>
+
+#define LATENCY_WINDOW 600  // Samples kept (10 s at 60 fps)
+
+typedef struct {
+    uint32_t samples_us[LATENCY_WINDOW];  // Ring of the most recent samples
+    int count;
+    int next;
+} latency_stats_t;
+
+typedef struct {
+    int count;
+    float min_ms;
+    float avg_ms;
+    float p99_ms;
+    float max_ms;
+} latency_summary_t;
+
+void latency_init(latency_stats_t *stats);
+void latency_add(latency_stats_t *stats, uint64_t latency_ns);
+void latency_summarize(const latency_stats_t *stats, latency_summary_t *out);
+
+#endif
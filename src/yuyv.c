@@ -0,0 +1,638 @@
+/*
+ * yuyv.c - YUYV to RGBA conversion kernels with runtime CPU dispatch
+ *
+ * Every kernel computes what the scalar one does: chroma terms in 32 bits,
+ * shifted right by 8 (rounding down), added to luma in 16 bits and
+ * saturated to 0..255.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "yuyv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define YUYV_X86
+#endif
+
+// NEON is always there on AArch64. 32-bit ARM gcc (Raspberry Pi OS) leaves it
+// off, so only the NEON functions are built for it, like the x86 kernels, and
+// the CPU is checked at runtime. arm_neon.h needs a hard-float ABI there.
+#if defined(__aarch64__) || (defined(__arm__) && defined(__ARM_FP))
+#include <arm_neon.h>
+#define YUYV_NEON
+#if defined(__aarch64__)
+#define YUYV_NEON_TARGET
+#else
+#include <sys/auxv.h>  // getauxval, HWCAP_ARM_NEON
+#define YUYV_NEON_TARGET __attribute__((target("fpu=neon")))
+#endif
+#endif
+
+#define YUYV_SAMPLE_BATCH 256  // Samples gathered per kernel call
+#define YUYV_BOX_SPAN 2048     // Pixels of column sums per box filter pass
+
+typedef struct {
+    const char *name;
+    yuyv_row_fn row;
+} yuyv_kernel_t;
+
+void yuyv_row_scalar(const uint8_t *src, uint8_t *dst, int pixels) {
+    for (int x = 0; x < pixels; x += 2) {
+        int y0 = src[0];
+        int u  = src[1];
+        int y1 = src[2];
+        int v  = src[3];
+        src += 4;
+
+        int uu = u - 128;
+        int vv = v - 128;
+        int ruv = (359 * vv) >> 8;
+        int guv = (88 * uu + 183 * vv) >> 8;
+        int buv = (454 * uu) >> 8;
+
+        int r0 = y0 + ruv;
+        int g0 = y0 - guv;
+        int b0 = y0 + buv;
+        int r1 = y1 + ruv;
+        int g1 = y1 - guv;
+        int b1 = y1 + buv;
+
+        dst[0] = r0 < 0 ? 0 : (r0 > 255 ? 255 : r0);
+        dst[1] = g0 < 0 ? 0 : (g0 > 255 ? 255 : g0);
+        dst[2] = b0 < 0 ? 0 : (b0 > 255 ? 255 : b0);
+        dst[3] = 255;
+        dst[4] = r1 < 0 ? 0 : (r1 > 255 ? 255 : r1);
+        dst[5] = g1 < 0 ? 0 : (g1 > 255 ? 255 : g1);
+        dst[6] = b1 < 0 ? 0 : (b1 > 255 ? 255 : b1);
+        dst[7] = 255;
+        dst += 8;
+    }
+}
+
+static const yuyv_kernel_t *selected_kernel(void);
+#ifdef YUYV_NEON
+static void yuyv_row_neon(const uint8_t *src, uint8_t *dst, int pixels);
+#endif
+
+// Gathers the YUYV pair holding each sample, converts the pairs with the row
+// kernel and keeps the sample's half: two pixels converted per sample, still
+// well ahead of converting the samples one at a time in scalar code
+void yuyv_sample_row(const uint8_t *src, int first, int step, uint8_t *dst, int pixels) {
+    yuyv_row_fn convert_row = selected_kernel()->row;
+    uint32_t pairs[YUYV_SAMPLE_BATCH];
+    uint32_t rgba[YUYV_SAMPLE_BATCH * 2];
+
+    for (int x = 0; x < pixels; x += YUYV_SAMPLE_BATCH) {
+        int n = pixels - x < YUYV_SAMPLE_BATCH ? pixels - x : YUYV_SAMPLE_BATCH;
+        int px = first + x * step;
+        for (int i = 0; i < n; i++, px += step) memcpy(&pairs[i], src + (px & ~1) * 2, 4);
+        convert_row((const uint8_t *)pairs, (uint8_t *)rgba, n * 2);
+
+        px = first + x * step;
+        for (int i = 0; i < n; i++, px += step) memcpy(dst + (x + i) * 4, &rgba[i * 2 + (px & 1)], 4);
+    }
+}
+
+// Column sums of bytes from..bytes-1, one at a time
+static void box_column_sums_scalar(const uint8_t *row, int stride, int rows, uint16_t *sums, int from, int bytes) {
+    for (int i = from; i < bytes; i++) {
+        uint16_t sum = 0;
+        for (int r = 0; r < rows; r++) sum += row[r * stride + i];
+        sums[i] = sum;
+    }
+}
+
+#ifdef YUYV_NEON
+YUYV_NEON_TARGET
+static void box_column_sums_neon(const uint8_t *row, int stride, int rows, uint16_t *sums, int bytes) {
+    int i = 0;
+    for (; i + 16 <= bytes; i += 16) {
+        uint16x8_t lo = vdupq_n_u16(0), hi = vdupq_n_u16(0);
+        for (int r = 0; r < rows; r++) {
+            uint8x16_t in = vld1q_u8(row + r * stride + i);
+            lo = vaddw_u8(lo, vget_low_u8(in));
+            hi = vaddw_u8(hi, vget_high_u8(in));
+        }
+        vst1q_u16(sums + i, lo);
+        vst1q_u16(sums + i + 8, hi);
+    }
+    box_column_sums_scalar(row, stride, rows, sums, i, bytes);
+}
+#endif
+
+// Sum `rows` rows byte by byte into 16-bit column sums, 16 bytes at a time.
+// SSE2 is baseline on x86-64; NEON goes with the selected kernel, as 32-bit
+// ARM cores may not have it.
+static void box_column_sums(const uint8_t *row, int stride, int rows, uint16_t *sums, int bytes) {
+    int i = 0;
+#if defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= bytes; i += 16) {
+        __m128i lo = zero, hi = zero;
+        for (int r = 0; r < rows; r++) {
+            __m128i in = _mm_loadu_si128((const __m128i *)(row + r * stride + i));
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(in, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(in, zero));
+        }
+        _mm_storeu_si128((__m128i *)(sums + i), lo);
+        _mm_storeu_si128((__m128i *)(sums + i + 8), hi);
+    }
+#elif defined(YUYV_NEON)
+    if (selected_kernel()->row == yuyv_row_neon) {
+        box_column_sums_neon(row, stride, rows, sums, bytes);
+        return;
+    }
+#endif
+    box_column_sums_scalar(row, stride, rows, sums, i, bytes);
+}
+
+// Cell means from column sums of cells made of whole YUYV pairs
+static inline __attribute__((always_inline))
+void box_paired_cells(const uint16_t *cell, int step, uint8_t *out, int cells) {
+    uint32_t area = step * step;
+
+    for (int i = 0; i < cells; i++, cell += step * 2, out += 4) {
+        uint32_t y = 0, u = 0, v = 0;
+        for (int k = 0; k < step * 2; k += 4) {
+            y += cell[k] + cell[k + 2];
+            u += cell[k + 1];
+            v += cell[k + 3];
+        }
+        // Chroma sums hold half as many samples as luma ones
+        out[0] = out[2] = (uint8_t)((y + area / 2) / area);
+        out[1] = (uint8_t)((u + area / 4) / (area / 2));
+        out[3] = (uint8_t)((v + area / 4) / (area / 2));
+    }
+}
+
+// Column sums of the cells' rows come first (SSE2 or NEON in box_column_sums);
+// each cell then adds its step column sums per channel in scalar code and
+// divides by a reciprocal multiply, exact for these sums
+void yuyv_box_pairs(const uint8_t *src, int stride, int first, int step, uint8_t *pairs, int pixels) {
+    uint16_t sums[(YUYV_BOX_SPAN + 2) * 2];
+    int batch = YUYV_BOX_SPAN / step;
+    uint32_t area = step * step;
+    uint64_t recip = (1ull << 32) / area + 1;  // x * recip >> 32 = x / area while x < 2^32 / area
+
+    for (int x = 0; x < pixels; x += batch) {
+        int n = pixels - x < batch ? pixels - x : batch;
+        int start = (first + x * step) & ~1;  // Whole pairs, for the chroma of the first pixel
+        int end = (first + (x + n) * step + 1) & ~1;
+        int bytes = (end - start) * 2;
+
+        box_column_sums(src + start * 2, stride, step, sums, bytes);
+
+        // Even cells starting on a pair hold whole pairs: the usual case, with
+        // step a constant so the sums unroll and the division is a shift or multiply
+        if (!(step & 1) && !(first & 1)) {
+            const uint16_t *cell = sums + (first + x * step - start) * 2;
+            uint8_t *out = pairs + x * 4;
+            switch (step) {
+                case 2: box_paired_cells(cell, 2, out, n); continue;
+                case 4: box_paired_cells(cell, 4, out, n); continue;
+                case 6: box_paired_cells(cell, 6, out, n); continue;
+                case 8: box_paired_cells(cell, 8, out, n); continue;
+            }
+        }
+        for (int i = 0; i < n; i++) {
+            int px = first + (x + i) * step - start;
+            uint32_t y = 0, u = 0, v = 0;
+            for (int k = 0; k < step; k++, px++) {
+                const uint16_t *pair = sums + (px & ~1) * 2;
+                y += pair[(px & 1) * 2];
+                u += pair[1];
+                v += pair[3];
+            }
+            uint8_t *out = pairs + (x + i) * 4;
+            out[0] = out[2] = (uint8_t)(((y + area / 2) * recip) >> 32);
+            out[1] = (uint8_t)(((u + area / 2) * recip) >> 32);
+            out[3] = (uint8_t)(((v + area / 2) * recip) >> 32);
+        }
+    }
+}
+
+void yuyv_box_row(const uint8_t *src, int stride, int first, int step, uint8_t *dst, int pixels) {
+    yuyv_row_fn convert_row = selected_kernel()->row;
+    uint32_t pairs[YUYV_SAMPLE_BATCH];
+    uint32_t rgba[YUYV_SAMPLE_BATCH * 2];
+
+    for (int x = 0; x < pixels; x += YUYV_SAMPLE_BATCH) {
+        int n = pixels - x < YUYV_SAMPLE_BATCH ? pixels - x : YUYV_SAMPLE_BATCH;
+        yuyv_box_pairs(src, stride, first + x * step, step, (uint8_t *)pairs, n);
+        convert_row((const uint8_t *)pairs, (uint8_t *)rgba, n * 2);
+        for (int i = 0; i < n; i++) memcpy(dst + (x + i) * 4, &rgba[i * 2], 4);
+    }
+}
+
+// I420 from pixel x on: luma copied, chroma of the two rows averaged (rounding up)
+static void iyuv_rows_scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                             uint8_t *u, uint8_t *v, int x, int pixels) {
+    for (; x + 2 <= pixels; x += 2) {
+        y0[x] = row0[x * 2];
+        y0[x + 1] = row0[x * 2 + 2];
+        y1[x] = row1[x * 2];
+        y1[x + 1] = row1[x * 2 + 2];
+        u[x / 2] = (row0[x * 2 + 1] + row1[x * 2 + 1] + 1) >> 1;
+        v[x / 2] = (row0[x * 2 + 3] + row1[x * 2 + 3] + 1) >> 1;
+    }
+}
+
+#ifdef YUYV_NEON
+// 32 pixels per step: vld4 splits even Y, U, odd Y and V, vst2 puts the luma back in order
+YUYV_NEON_TARGET
+static void iyuv_rows_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                           uint8_t *u, uint8_t *v, int pixels) {
+    int x = 0;
+    for (; x + 32 <= pixels; x += 32) {
+        uint8x16x4_t a = vld4q_u8(row0 + x * 2);
+        uint8x16x4_t b = vld4q_u8(row1 + x * 2);
+        uint8x16x2_t luma_a = { { a.val[0], a.val[2] } };
+        uint8x16x2_t luma_b = { { b.val[0], b.val[2] } };
+        vst2q_u8(y0 + x, luma_a);
+        vst2q_u8(y1 + x, luma_b);
+        vst1q_u8(u + x / 2, vrhaddq_u8(a.val[1], b.val[1]));
+        vst1q_u8(v + x / 2, vrhaddq_u8(a.val[3], b.val[3]));
+    }
+    iyuv_rows_scalar(row0, row1, y0, y1, u, v, x, pixels);
+}
+#endif
+
+// SSE2 is baseline on x86-64; NEON goes with the selected kernel, as for the box filter
+void yuyv_iyuv_rows(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                    uint8_t *u, uint8_t *v, int pixels) {
+    int x = 0;
+#if defined(__SSE2__)
+    // 16 pixels per step: luma is the low byte of each 16-bit lane, chroma the
+    // high one; pavgb averages the rows' chroma, which then splits into U and V
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    for (; x + 32 <= pixels; x += 32) {
+        __m128i uv[2];
+        for (int half = 0; half < 2; half++) {
+            const uint8_t *p0 = row0 + (x + half * 16) * 2;
+            const uint8_t *p1 = row1 + (x + half * 16) * 2;
+            __m128i a0 = _mm_loadu_si128((const __m128i *)p0);
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(p0 + 16));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)p1);
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(p1 + 16));
+            _mm_storeu_si128((__m128i *)(y0 + x + half * 16),
+                             _mm_packus_epi16(_mm_and_si128(a0, low_bytes), _mm_and_si128(a1, low_bytes)));
+            _mm_storeu_si128((__m128i *)(y1 + x + half * 16),
+                             _mm_packus_epi16(_mm_and_si128(b0, low_bytes), _mm_and_si128(b1, low_bytes)));
+            __m128i uv_a = _mm_packus_epi16(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+            __m128i uv_b = _mm_packus_epi16(_mm_srli_epi16(b0, 8), _mm_srli_epi16(b1, 8));
+            uv[half] = _mm_avg_epu8(uv_a, uv_b);
+        }
+        _mm_storeu_si128((__m128i *)(u + x / 2),
+                         _mm_packus_epi16(_mm_and_si128(uv[0], low_bytes), _mm_and_si128(uv[1], low_bytes)));
+        _mm_storeu_si128((__m128i *)(v + x / 2),
+                         _mm_packus_epi16(_mm_srli_epi16(uv[0], 8), _mm_srli_epi16(uv[1], 8)));
+    }
+#elif defined(YUYV_NEON)
+    if (selected_kernel()->row == yuyv_row_neon) {
+        iyuv_rows_neon(row0, row1, y0, y1, u, v, pixels);
+        return;
+    }
+#endif
+    iyuv_rows_scalar(row0, row1, y0, y1, u, v, x, pixels);
+}
+
+// I420 from 3-byte YCbCr pixels, from pixel x on
+static void ycc_iyuv_scalar(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                            uint8_t *u, uint8_t *v, int x, int pixels, bool shared) {
+    for (; x + 2 <= pixels; x += 2) {
+        const uint8_t *a = row0 + x * 3, *b = row1 + x * 3;
+        y0[x] = a[0];
+        y0[x + 1] = a[3];
+        y1[x] = b[0];
+        y1[x + 1] = b[3];
+        if (shared) {
+            u[x / 2] = a[1];
+            v[x / 2] = a[2];
+        } else {
+            u[x / 2] = (a[1] + a[4] + b[1] + b[4] + 2) >> 2;
+            v[x / 2] = (a[2] + a[5] + b[2] + b[5] + 2) >> 2;
+        }
+    }
+}
+
+#ifdef YUYV_X86
+// One channel of 16 pixels (48 bytes) gathered with three byte shuffles
+__attribute__((target("ssse3")))
+static inline __m128i ycc_channel(__m128i p0, __m128i p1, __m128i p2, int channel) {
+    int8_t index[3][16];
+    for (int i = 0; i < 16; i++) {
+        for (int part = 0; part < 3; part++) {
+            int byte = i * 3 + channel - part * 16;
+            index[part][i] = byte >= 0 && byte < 16 ? byte : -1;
+        }
+    }
+    __m128i out = _mm_shuffle_epi8(p0, _mm_loadu_si128((const __m128i *)index[0]));
+    out = _mm_or_si128(out, _mm_shuffle_epi8(p1, _mm_loadu_si128((const __m128i *)index[1])));
+    return _mm_or_si128(out, _mm_shuffle_epi8(p2, _mm_loadu_si128((const __m128i *)index[2])));
+}
+
+// 32 pixels per step, 16 at a time per row: luma stored, chroma of even pixels
+// picked or pairs summed (pmaddubsw) across both rows
+__attribute__((target("ssse3")))
+static void ycc_iyuv_ssse3(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                           uint8_t *u, uint8_t *v, int pixels, bool shared) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i two = _mm_set1_epi16(2);
+    int x = 0;
+    for (; x + 32 <= pixels; x += 32) {
+        __m128i chroma[2][2];  // [U, V][half]
+        for (int half = 0; half < 2; half++) {
+            const uint8_t *a = row0 + (x + half * 16) * 3;
+            const uint8_t *b = row1 + (x + half * 16) * 3;
+            __m128i a0 = _mm_loadu_si128((const __m128i *)a);
+            __m128i a1 = _mm_loadu_si128((const __m128i *)(a + 16));
+            __m128i a2 = _mm_loadu_si128((const __m128i *)(a + 32));
+            __m128i b0 = _mm_loadu_si128((const __m128i *)b);
+            __m128i b1 = _mm_loadu_si128((const __m128i *)(b + 16));
+            __m128i b2 = _mm_loadu_si128((const __m128i *)(b + 32));
+            _mm_storeu_si128((__m128i *)(y0 + x + half * 16), ycc_channel(a0, a1, a2, 0));
+            _mm_storeu_si128((__m128i *)(y1 + x + half * 16), ycc_channel(b0, b1, b2, 0));
+            for (int c = 0; c < 2; c++) {
+                __m128i ca = ycc_channel(a0, a1, a2, c + 1);
+                if (shared) {
+                    chroma[c][half] = _mm_and_si128(ca, low_bytes);
+                } else {
+                    __m128i cb = ycc_channel(b0, b1, b2, c + 1);
+                    __m128i sum = _mm_add_epi16(_mm_maddubs_epi16(ca, ones), _mm_maddubs_epi16(cb, ones));
+                    chroma[c][half] = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                }
+            }
+        }
+        _mm_storeu_si128((__m128i *)(u + x / 2), _mm_packus_epi16(chroma[0][0], chroma[0][1]));
+        _mm_storeu_si128((__m128i *)(v + x / 2), _mm_packus_epi16(chroma[1][0], chroma[1][1]));
+    }
+    ycc_iyuv_scalar(row0, row1, y0, y1, u, v, x, pixels, shared);
+}
+#endif
+
+#ifdef YUYV_NEON
+// 32 pixels per step: vld3 splits the channels, even chroma comes from narrowing
+// 16-bit lanes, pair sums from vpaddl and a rounding narrow
+YUYV_NEON_TARGET
+static void ycc_iyuv_neon(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                          uint8_t *u, uint8_t *v, int pixels, bool shared) {
+    int x = 0;
+    for (; x + 32 <= pixels; x += 32) {
+        uint8x8_t chroma[2][2];  // [U, V][half]
+        for (int half = 0; half < 2; half++) {
+            uint8x16x3_t a = vld3q_u8(row0 + (x + half * 16) * 3);
+            uint8x16x3_t b = vld3q_u8(row1 + (x + half * 16) * 3);
+            vst1q_u8(y0 + x + half * 16, a.val[0]);
+            vst1q_u8(y1 + x + half * 16, b.val[0]);
+            for (int c = 0; c < 2; c++) {
+                if (shared) {
+                    chroma[c][half] = vmovn_u16(vreinterpretq_u16_u8(a.val[c + 1]));
+                } else {
+                    uint16x8_t sum = vaddq_u16(vpaddlq_u8(a.val[c + 1]), vpaddlq_u8(b.val[c + 1]));
+                    chroma[c][half] = vrshrn_n_u16(sum, 2);
+                }
+            }
+        }
+        vst1q_u8(u + x / 2, vcombine_u8(chroma[0][0], chroma[0][1]));
+        vst1q_u8(v + x / 2, vcombine_u8(chroma[1][0], chroma[1][1]));
+    }
+    ycc_iyuv_scalar(row0, row1, y0, y1, u, v, x, pixels, shared);
+}
+#endif
+
+// SSSE3 is not baseline on x86-64, so it is checked at runtime like the RGBA
+// kernels; forcing the scalar kernel with CAPTUREDISP_YUYV keeps this scalar too
+void yuyv_ycc_iyuv_rows(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                        uint8_t *u, uint8_t *v, int pixels, bool shared) {
+#ifdef YUYV_X86
+    if (selected_kernel()->row != yuyv_row_scalar && __builtin_cpu_supports("ssse3")) {
+        ycc_iyuv_ssse3(row0, row1, y0, y1, u, v, pixels, shared);
+        return;
+    }
+#elif defined(YUYV_NEON)
+    if (selected_kernel()->row == yuyv_row_neon) {
+        ycc_iyuv_neon(row0, row1, y0, y1, u, v, pixels, shared);
+        return;
+    }
+#endif
+    ycc_iyuv_scalar(row0, row1, y0, y1, u, v, 0, pixels, shared);
+}
+
+#ifdef YUYV_X86
+// 16 pixels per step. As 16-bit lanes a YUYV vector is Y in the low bytes and
+// U, V alternating in the high bytes, so each (U, V) pair is one pmaddwd input.
+__attribute__((target("sse2")))
+static void yuyv_row_sse2(const uint8_t *src, uint8_t *dst, int pixels) {
+    const __m128i low_bytes = _mm_set1_epi16(0x00FF);
+    const __m128i bias = _mm_set1_epi16(128);
+    const __m128i k_r = _mm_set1_epi32(359 << 16);          // 0 * U + 359 * V
+    const __m128i k_g = _mm_set1_epi32(88 | (183 << 16));   // 88 * U + 183 * V
+    const __m128i k_b = _mm_set1_epi32(454);                // 454 * U + 0 * V
+    const __m128i alpha = _mm_set1_epi8((char)0xFF);
+
+    int x = 0;
+    for (; x + 16 <= pixels; x += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + x * 2));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + x * 2 + 16));
+        __m128i ya = _mm_and_si128(a, low_bytes);
+        __m128i yb = _mm_and_si128(b, low_bytes);
+        __m128i uva = _mm_sub_epi16(_mm_srli_epi16(a, 8), bias);
+        __m128i uvb = _mm_sub_epi16(_mm_srli_epi16(b, 8), bias);
+
+        // One term per pair, then each pair's term for both of its pixels
+        __m128i r = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uva, k_r), 8),
+                                    _mm_srai_epi32(_mm_madd_epi16(uvb, k_r), 8));
+        __m128i g = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uva, k_g), 8),
+                                    _mm_srai_epi32(_mm_madd_epi16(uvb, k_g), 8));
+        __m128i bl = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uva, k_b), 8),
+                                     _mm_srai_epi32(_mm_madd_epi16(uvb, k_b), 8));
+        __m128i R = _mm_packus_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(r, r)),
+                                     _mm_add_epi16(yb, _mm_unpackhi_epi16(r, r)));
+        __m128i G = _mm_packus_epi16(_mm_sub_epi16(ya, _mm_unpacklo_epi16(g, g)),
+                                     _mm_sub_epi16(yb, _mm_unpackhi_epi16(g, g)));
+        __m128i B = _mm_packus_epi16(_mm_add_epi16(ya, _mm_unpacklo_epi16(bl, bl)),
+                                     _mm_add_epi16(yb, _mm_unpackhi_epi16(bl, bl)));
+
+        __m128i rg_lo = _mm_unpacklo_epi8(R, G), rg_hi = _mm_unpackhi_epi8(R, G);
+        __m128i ba_lo = _mm_unpacklo_epi8(B, alpha), ba_hi = _mm_unpackhi_epi8(B, alpha);
+        __m128i *out = (__m128i *)(dst + x * 4);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+    yuyv_row_scalar(src + x * 2, dst + x * 4, pixels - x);
+}
+
+// The SSE2 steps in each 128-bit lane, 32 pixels per step: the loads give
+// lane 0 pixels 0-15 and lane 1 pixels 16-31, the stores put them back in order
+__attribute__((target("avx2")))
+static void yuyv_row_avx2(const uint8_t *src, uint8_t *dst, int pixels) {
+    const __m256i low_bytes = _mm256_set1_epi16(0x00FF);
+    const __m256i bias = _mm256_set1_epi16(128);
+    const __m256i k_r = _mm256_set1_epi32(359 << 16);
+    const __m256i k_g = _mm256_set1_epi32(88 | (183 << 16));
+    const __m256i k_b = _mm256_set1_epi32(454);
+    const __m256i alpha = _mm256_set1_epi8((char)0xFF);
+
+    int x = 0;
+    for (; x + 32 <= pixels; x += 32) {
+        const uint8_t *in = src + x * 2;
+        __m256i a = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)in)),
+                                            _mm_loadu_si128((const __m128i *)(in + 32)), 1);
+        __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 16))),
+                                            _mm_loadu_si128((const __m128i *)(in + 48)), 1);
+        __m256i ya = _mm256_and_si256(a, low_bytes);
+        __m256i yb = _mm256_and_si256(b, low_bytes);
+        __m256i uva = _mm256_sub_epi16(_mm256_srli_epi16(a, 8), bias);
+        __m256i uvb = _mm256_sub_epi16(_mm256_srli_epi16(b, 8), bias);
+
+        __m256i r = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_madd_epi16(uva, k_r), 8),
+                                       _mm256_srai_epi32(_mm256_madd_epi16(uvb, k_r), 8));
+        __m256i g = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_madd_epi16(uva, k_g), 8),
+                                       _mm256_srai_epi32(_mm256_madd_epi16(uvb, k_g), 8));
+        __m256i bl = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_madd_epi16(uva, k_b), 8),
+                                        _mm256_srai_epi32(_mm256_madd_epi16(uvb, k_b), 8));
+        __m256i R = _mm256_packus_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(r, r)),
+                                        _mm256_add_epi16(yb, _mm256_unpackhi_epi16(r, r)));
+        __m256i G = _mm256_packus_epi16(_mm256_sub_epi16(ya, _mm256_unpacklo_epi16(g, g)),
+                                        _mm256_sub_epi16(yb, _mm256_unpackhi_epi16(g, g)));
+        __m256i B = _mm256_packus_epi16(_mm256_add_epi16(ya, _mm256_unpacklo_epi16(bl, bl)),
+                                        _mm256_add_epi16(yb, _mm256_unpackhi_epi16(bl, bl)));
+
+        __m256i rg_lo = _mm256_unpacklo_epi8(R, G), rg_hi = _mm256_unpackhi_epi8(R, G);
+        __m256i ba_lo = _mm256_unpacklo_epi8(B, alpha), ba_hi = _mm256_unpackhi_epi8(B, alpha);
+        __m256i p0 = _mm256_unpacklo_epi16(rg_lo, ba_lo);  // Pixels 0-3 | 16-19
+        __m256i p1 = _mm256_unpackhi_epi16(rg_lo, ba_lo);  // 4-7 | 20-23
+        __m256i p2 = _mm256_unpacklo_epi16(rg_hi, ba_hi);  // 8-11 | 24-27
+        __m256i p3 = _mm256_unpackhi_epi16(rg_hi, ba_hi);  // 12-15 | 28-31
+        __m256i *out = (__m256i *)(dst + x * 4);
+        _mm256_storeu_si256(out + 0, _mm256_permute2x128_si256(p0, p1, 0x20));
+        _mm256_storeu_si256(out + 1, _mm256_permute2x128_si256(p2, p3, 0x20));
+        _mm256_storeu_si256(out + 2, _mm256_permute2x128_si256(p0, p1, 0x31));
+        _mm256_storeu_si256(out + 3, _mm256_permute2x128_si256(p2, p3, 0x31));
+    }
+    yuyv_row_scalar(src + x * 2, dst + x * 4, pixels - x);
+}
+#endif
+
+#ifdef YUYV_NEON
+// (ku * u + kv * v) >> 8 for 8 pairs, in 32 bits like the scalar code
+YUYV_NEON_TARGET
+static inline int16x8_t neon_chroma(int16x8_t u, int16x8_t v, int16_t ku, int16_t kv) {
+    int32x4_t lo = vmlal_n_s16(vmull_n_s16(vget_low_s16(u), ku), vget_low_s16(v), kv);
+    int32x4_t hi = vmlal_n_s16(vmull_n_s16(vget_high_s16(u), ku), vget_high_s16(v), kv);
+    return vcombine_s16(vshrn_n_s32(lo, 8), vshrn_n_s32(hi, 8));
+}
+
+// 32 pixels per step: vld4 splits even Y, U, odd Y and V, vzip puts even
+// and odd pixels back together, vst4 interleaves RGBA
+YUYV_NEON_TARGET
+static void yuyv_row_neon(const uint8_t *src, uint8_t *dst, int pixels) {
+    const uint8x8_t bias = vdup_n_u8(128);
+
+    int x = 0;
+    for (; x + 32 <= pixels; x += 32) {
+        uint8x16x4_t in = vld4q_u8(src + x * 2);
+        uint8x8_t r[2][2], g[2][2], b[2][2];  // [even/odd pixel][pairs 0-7/8-15]
+
+        for (int half = 0; half < 2; half++) {
+            uint8x8_t u8 = half ? vget_high_u8(in.val[1]) : vget_low_u8(in.val[1]);
+            uint8x8_t v8 = half ? vget_high_u8(in.val[3]) : vget_low_u8(in.val[3]);
+            int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(u8, bias));
+            int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(v8, bias));
+            int16x8_t ruv = neon_chroma(u, v, 0, 359);
+            int16x8_t guv = neon_chroma(u, v, 88, 183);
+            int16x8_t buv = neon_chroma(u, v, 454, 0);
+
+            for (int odd = 0; odd < 2; odd++) {
+                uint8x16_t luma = in.val[odd * 2];
+                int16x8_t y = vreinterpretq_s16_u16(vmovl_u8(half ? vget_high_u8(luma) : vget_low_u8(luma)));
+                r[odd][half] = vqmovun_s16(vaddq_s16(y, ruv));
+                g[odd][half] = vqmovun_s16(vsubq_s16(y, guv));
+                b[odd][half] = vqmovun_s16(vaddq_s16(y, buv));
+            }
+        }
+
+        uint8x16x2_t rz = vzipq_u8(vcombine_u8(r[0][0], r[0][1]), vcombine_u8(r[1][0], r[1][1]));
+        uint8x16x2_t gz = vzipq_u8(vcombine_u8(g[0][0], g[0][1]), vcombine_u8(g[1][0], g[1][1]));
+        uint8x16x2_t bz = vzipq_u8(vcombine_u8(b[0][0], b[0][1]), vcombine_u8(b[1][0], b[1][1]));
+        uint8x16x4_t out;
+        out.val[3] = vdupq_n_u8(255);
+        for (int i = 0; i < 2; i++) {
+            out.val[0] = rz.val[i];
+            out.val[1] = gz.val[i];
+            out.val[2] = bz.val[i];
+            vst4q_u8(dst + (x + i * 16) * 4, out);
+        }
+    }
+    yuyv_row_scalar(src + x * 2, dst + x * 4, pixels - x);
+}
+
+static bool neon_supported(void) {
+#ifdef __aarch64__
+    return true;
+#else
+    return (getauxval(AT_HWCAP) & HWCAP_ARM_NEON) != 0;
+#endif
+}
+#endif
+
+static const yuyv_kernel_t scalar_kernel = { "scalar", yuyv_row_scalar };
+
+// Best kernel the CPU runs, or the one CAPTUREDISP_YUYV names if it runs it
+static const yuyv_kernel_t *pick_kernel(void) {
+    static const yuyv_kernel_t kernels[] = {
+#ifdef YUYV_X86
+        { "avx2", yuyv_row_avx2 },
+        { "sse2", yuyv_row_sse2 },
+#endif
+#ifdef YUYV_NEON
+        { "neon", yuyv_row_neon },
+#endif
+        { "scalar", yuyv_row_scalar },
+    };
+    const char *wanted = getenv("CAPTUREDISP_YUYV");
+    if (wanted && !wanted[0]) wanted = NULL;
+
+#ifdef YUYV_X86
+    __builtin_cpu_init();
+#endif
+    for (size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++) {
+        const yuyv_kernel_t *k = &kernels[i];
+        bool supported = true;
+#ifdef YUYV_X86
+        if (k->row == yuyv_row_avx2) supported = __builtin_cpu_supports("avx2");
+        if (k->row == yuyv_row_sse2) supported = __builtin_cpu_supports("sse2");
+#endif
+#ifdef YUYV_NEON
+        if (k->row == yuyv_row_neon) supported = neon_supported();
+#endif
+        if (supported && (!wanted || strcmp(wanted, k->name) == 0)) return k;
+    }
+    return &scalar_kernel;
+}
+
+static const yuyv_kernel_t *selected_kernel(void) {
+    static _Atomic(const yuyv_kernel_t *) selected;
+    const yuyv_kernel_t *k = atomic_load_explicit(&selected, memory_order_acquire);
+    if (!k) {
+        // Racing first calls pick the same kernel, whichever store wins
+        k = pick_kernel();
+        atomic_store_explicit(&selected, k, memory_order_release);
+    }
+    return k;
+}
+
+yuyv_row_fn yuyv_row_kernel(void) {
+    return selected_kernel()->row;
+}
+
+const char *yuyv_kernel_name(void) {
+    return selected_kernel()->name;
+}
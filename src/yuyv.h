@@ -0,0 +1,49 @@
+/*
+ * yuyv.h - YUYV to RGBA conversion kernels
+ *
+ * BT.601 full range. The scalar kernel is the reference: the SIMD kernels
+ * (SSE2 and AVX2 on x86, NEON on ARM) produce the same bytes, using
+ * saturating packs instead of per-channel clamping branches, and the
+ * fastest one the CPU supports is picked at runtime.
+ */
+
+#ifndef YUYV_H
+#define YUYV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Convert one run of YUYV pixels to RGBA, pixels rounded up to a pair
+typedef void (*yuyv_row_fn)(const uint8_t *src, uint8_t *dst, int pixels);
+
+void yuyv_row_scalar(const uint8_t *src, uint8_t *dst, int pixels);
+
+// Convert `pixels` single pixels `step` apart in a YUYV row, from pixel `first`,
+// each with the chroma of its own pair: one pixel per cell of upscaled content
+void yuyv_sample_row(const uint8_t *src, int first, int step, uint8_t *dst, int pixels);
+
+// Mean of each step x step cell instead, the cells' top row at src and stride
+// bytes between rows: cleaner than one sample on noisy captures. Luma is the
+// mean of the cell's pixels, chroma the mean of the chroma samples covering
+// them, at the 4:2:2 rate the card sends. As YUYV pairs, one per cell with
+// both luma bytes the same, then converted to RGBA. Cells up to 32x32.
+void yuyv_box_pairs(const uint8_t *src, int stride, int first, int step, uint8_t *pairs, int pixels);
+void yuyv_box_row(const uint8_t *src, int stride, int first, int step, uint8_t *dst, int pixels);
+
+// Two YUYV rows to I420: luma of each row copied, U and V of the pair averaged
+// (rounding up) at half width. pixels even.
+void yuyv_iyuv_rows(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                    uint8_t *u, uint8_t *v, int pixels);
+
+// Same from two rows of 3-byte YCbCr pixels (libjpeg's JCS_YCbCr output): chroma
+// of each 2x2 block averaged (rounding to nearest), or with shared = the block is
+// one replicated sample, its top-left taken as is. pixels even.
+void yuyv_ycc_iyuv_rows(const uint8_t *row0, const uint8_t *row1, uint8_t *y0, uint8_t *y1,
+                        uint8_t *u, uint8_t *v, int pixels, bool shared);
+
+// Fastest kernel for this CPU, chosen on first use.
+// CAPTUREDISP_YUYV=scalar|sse2|avx2|neon forces one, if the CPU has it.
+yuyv_row_fn yuyv_row_kernel(void);
+const char *yuyv_kernel_name(void);
+
+#endif